@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump pointer arena
+ * Allocations are carved out of large blocks and never freed one by one,
+ * arena_free() releases everything at once. Objects allocated one after the
+ * other end up next to each other in memory.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    size_t used;
+    size_t size;
+    max_align_t data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* block;      // Block currently allocated from, NULL before the first allocation
+    size_t block_size;      // Size of regular blocks, bigger requests get a block of their own
+} Arena;
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void arena_init(Arena* arena, size_t block_size);
+// Returns size bytes aligned for any type, NULL if out of memory
+void* arena_alloc(Arena* arena, size_t size);
+void arena_free(Arena* arena);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdint.h>
+#include "parser.h"
+
+/* Constant folding and propagation
+ * Runs inside the checker's walk (semantic.c): fold_leave() sees each node
+ * right after the checker typed it, so its children are already folded and
+ * checks on the parent, such as division by zero, see the folded values.
+ * A binary or unary operation on literals becomes the literal of its result,
+ * with the type get_result_type() gave it (folded literals can be negative).
+ * The tree itself doesn't change, the node is marked FOLD_CONSTANT and its
+ * value stored in FlatAST.value, later passes take it for an AST_LITERAL and
+ * don't look at its children. A variable assigned a literal is known until
+ * it is written again, reads of it become that literal, marked
+ * FOLD_PROPAGATED (as is anything folded from one) since the code reading it
+ * may never run.
+ *
+ * Known values are only trusted along straight line code. Each known value
+ * is tagged with the epoch it was set in and only those of the current epoch
+ * count. A loop or a function body starts a new epoch, on the way out the
+ * one from before comes back, minus the variables written inside (and all of
+ * it if a loop made a call, a call may write globals). The ones written in
+ * either branch of an if are forgotten once the branch is done.
+ * Conditions keep their shape, so a folded condition is checked like the
+ * expression it came from.
+ */
+typedef struct {
+    uint64_t epoch;
+    int calls;
+} FoldScope;
+
+typedef struct {
+    TokenValue* values;         // Indexed by var_index
+    uint64_t* known;            // Epoch each value was set in, 0 if never
+    int capacity;
+    uint64_t epoch;             // Current one, 0 until a value is set
+    uint64_t last_epoch;        // Epochs are never reused
+    int calls;                  // Calls to functions seen so far
+    FoldScope* scopes;          // Open loops and function bodies
+    int scope_count;
+    int scope_capacity;
+    int* written;               // Variables set since the outermost open if started
+    int written_count;
+    int written_capacity;
+    int* marks;                 // written_count when each open if started
+    int mark_count;
+    int mark_capacity;
+} Constants;
+
+// Type of node once folded, AST_LITERAL if it was folded into a constant
+static inline ASTType folded_type(const FlatAST* ast, NodeId node) {
+    return ast->folded[node] ? AST_LITERAL : flat_type(ast, node);
+}
+
+// Zero initialized is empty
+void fold_enter(Constants* constants, const FlatAST* ast, const WalkFrame* frame);
+// Call once the node is typed
+void fold_leave(Constants* constants, FlatAST* ast, const WalkFrame* frame);
+void fold_free(Constants* constants);
+
+#endif
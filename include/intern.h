@@ -0,0 +1,25 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* String interner
+ * Every distinct identifier and string literal is stored once, NUL-terminated,
+ * and gets a small stable ID, so names compare as integers. IDs are never 0,
+ * INTERN_NONE means "not interned" (keywords, operators, numbers, ...).
+ * The table is global and may be used from several threads at once, the
+ * parallel lexer interns from its workers. Strings live until intern_free().
+ */
+typedef uint32_t InternId;
+#define INTERN_NONE 0
+
+InternId intern(const char* str, size_t length);
+// Text and length of an interned string, "" and 0 for INTERN_NONE
+const char* intern_text(InternId id);
+size_t intern_length(InternId id);
+// Number of distinct strings interned so far
+size_t intern_count(void);
+void intern_free(void);
+
+#endif
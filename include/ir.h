@@ -0,0 +1,146 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "semantic.h"
+
+/* Three address IR in SSA form
+ * A checked program is lowered one function at a time, the top level
+ * statements form a function of their own. A function is a graph of basic
+ * blocks, block 0 is the entry. Each block holds its phis, then its other
+ * instructions, the last of which is the terminator (jump, branch, return).
+ * Every instruction defines at most one value, its index in the function's
+ * insts, typed with the DataType the checker gave the expression.
+ *
+ * Variables are referred to by their var_index. Those local to one function
+ * live in SSA values only. A variable that is also used from another function
+ * (a global read in a function body, say) lives in memory instead, it is read
+ * with IR_LOAD and written with IR_STORE, and a call may change it.
+ */
+typedef uint32_t IrValue;       // Index into IrFunction.insts
+typedef uint32_t IrBlockId;     // Index into IrFunction.blocks
+#define IR_NONE UINT32_MAX
+
+typedef enum {
+    IR_CONST,           // value, or string for TYPE_STRING
+    IR_UNDEF,           // variable read before any write on some path
+    IR_PARAM,           // index-th parameter
+    IR_PHI,             // args, one per predecessor in the order of preds
+    IR_COPY,            // a, only while building: a phi replaced by a
+    IR_BINARY,          // a kind b, kind is the operator's TokenKind
+    IR_UNARY,           // kind a, OP_SUB, OP_NOT or OP_BITNOT
+    IR_CONVERT,         // a converted to type, between float and the integer types
+    IR_FACTORIAL,       // factorial(a)
+    IR_LOAD,            // memory variable var
+    IR_STORE,           // var = a, no value
+    IR_CALL,            // function var with args
+    IR_PRINT,           // print a, no value
+    IR_JUMP,            // to target[0]
+    IR_BRANCH,          // a != 0 ? target[0] : target[1]
+    IR_RETURN,          // end of the function
+} IrOp;
+
+typedef struct {
+    unsigned char op;           // IrOp
+    unsigned char type;         // DataType of the value
+    unsigned short kind;        // TokenKind of IR_BINARY and IR_UNARY
+    IrBlockId block;            // Block it is in, IR_NONE once removed
+    IrValue a;
+    IrValue b;
+    int var;                    // var_index of IR_LOAD, IR_STORE, IR_CALL and IR_PHI, VAR_NONE otherwise
+    int line;
+    union {
+        TokenValue value;
+        InternId string;
+        uint32_t index;
+        IrBlockId target[2];
+        struct {
+            uint32_t first;     // Into IrFunction.operands
+            uint32_t count;
+        } args;
+    };
+} IrInst;
+
+typedef struct {
+    IrValue* phis;
+    uint32_t phi_count;
+    uint32_t phi_capacity;
+    IrValue* insts;             // Terminator last
+    uint32_t count;
+    uint32_t capacity;
+    IrBlockId* preds;
+    uint32_t pred_count;
+    uint32_t pred_capacity;
+    int sealed;                 // All preds are known, see ir_build.c
+} IrBlock;
+
+typedef struct {
+    InternId name;              // INTERN_NONE for the top level code
+    int var;                    // Its var_index, VAR_NONE for the top level code
+    DataType type;
+    uint32_t param_count;
+    IrInst* insts;
+    uint32_t inst_count;
+    uint32_t inst_capacity;
+    IrValue* operands;          // Phi and call operands
+    uint32_t operand_count;
+    uint32_t operand_capacity;
+    IrBlock* blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+} IrFunction;
+
+typedef struct {
+    IrFunction* functions;      // The top level code first, then each function as it is found
+    uint32_t function_count;
+    uint32_t function_capacity;
+    Variable* variables;        // Copy of the checker's, indexed by var_index
+    int variable_count;
+    unsigned char* in_memory;   // Per variable, set if it is loaded and stored
+} IrProgram;
+
+// Lowers a program that parsed and checked without errors, table is the one
+// it was checked with. Returns 0, or -1 if out of memory
+int ir_build(IrProgram* program, const FlatAST* ast, const SymbolTable* table);
+void ir_free(IrProgram* program);
+void ir_print(const IrProgram* program);
+// Folds constant branches, drops unreachable blocks, dead stores and
+// unused values, see ir_dce.c
+void ir_eliminate_dead_code(IrProgram* program);
+// Moves loop-invariant code to the loops' preheaders, see ir_licm.c
+void ir_hoist_invariants(IrProgram* program);
+// Replaces computations an earlier, dominating one already did, see ir_gvn.c
+void ir_number_values(IrProgram* program);
+
+// Building blocks for ir_build and the passes working on the IR
+// Grows an array to hold at least needed elements, exits if out of memory
+void* ir_grow(void* array, uint32_t* capacity, uint32_t needed, size_t size);
+#define IR_PUSH(array, count, capacity, item) do { \
+        (array) = ir_grow((array), &(capacity), (count) + 1, sizeof(*(array))); \
+        (array)[(count)++] = (item); \
+    } while (0)
+IrBlockId ir_new_block(IrFunction* fn);
+IrValue ir_emit(IrFunction* fn, IrBlockId block, IrInst inst);
+IrValue ir_emit_phi(IrFunction* fn, IrBlockId block, DataType type, int var);
+void ir_add_pred(IrFunction* fn, IrBlockId block, IrBlockId pred);
+uint32_t ir_add_operands(IrFunction* fn, uint32_t count);
+// Successors of block, from its terminator. Returns how many (0 to 2)
+int ir_successors(const IrFunction* fn, IrBlockId block, IrBlockId succ[2]);
+// Follows IR_COPY forwarding to the value v stands for
+IrValue ir_resolve(const IrFunction* fn, IrValue v);
+IrValue ir_emit_undef(IrFunction* fn, DataType type);
+// Turns phi into an IR_COPY of its only operand other than itself, returns
+// what it stands for now (phi itself if it merges several values)
+IrValue ir_remove_trivial_phi(IrFunction* fn, IrValue phi);
+// Removes trivial phis until none is left and points every operand past the copies
+void ir_simplify_phis(IrFunction* fn);
+// Blocks reached from the entry in reverse postorder, returns how many
+uint32_t ir_reverse_postorder(const IrFunction* fn, IrBlockId* order);
+// Immediate dominator of every block, the entry is its own and blocks never
+// reached get IR_NONE
+void ir_dominators(const IrFunction* fn, IrBlockId* idom);
+// Whether a dominates b, walks up from b
+int ir_dominates(const IrBlockId* idom, IrBlockId a, IrBlockId b);
+
+#endif
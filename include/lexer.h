@@ -7,85 +7,74 @@
 #include <string.h>
 #include "tokens.h"
 
-#define NUM_KEYWORDS 14
-#define NUM_OPERATORS 32
-#define NUM_DELIMITERS 8
+// Token tables start at this many entries and double when full
+#define TOKEN_CHUNK 4096
+// Size of the token stream lookahead ring, must be a power of two
+#define LOOKAHEAD 4
+// Inputs are lexed in parallel with one thread per this many bytes (up to the core count)
+#define PARALLEL_MIN_CHUNK (1 << 20)
 
-#define MAXBUFLEN 1000000
-#define MAX_TABLE_SIZE 100000
 
+// Resolve a lexeme to its keyword/operator kind, KIND_NONE if it isn't one
+TokenKind keyword_kind(const char* str, int len);
+TokenKind operator_kind(const char* str, int len);
+// Spelling of a keyword/operator/delimiter kind, "" for KIND_NONE
+const char* kind_to_string(TokenKind kind);
 
-static char* keywords[] = {
-    "int",
-    "uint",
-    "float",
-    "string",
-    "char",
-    "object",
-    "if",
-    "else",
-    "for",
-    "while",
-    "loop",
-    "break",
-    "print",
-    "return",
-    "fn",
-};
+int is_keyword(const char* str, int len);
+int is_operator(const char* str, int len);
+int is_delimiter(char c);
 
-static char* operators[] = {
-    "==",
-    "=",
-    "!",
-    "!=",
-    ">",
-    ">=",
-    "<",
-    "<=",
-    "+",
-    "-",
-    "*",
-    "/",
-    "%",
-    ">>",
-    "<<",
-    "&",
-    "&&",
-    "|",
-    "||",
-    "^",
-    "+=",
-    "-=",
-    "*=",
-    "/=",
-    "%=",
-    ">>=",
-    "<<=",
-    "&=",
-    "&&=",
-    "|=",
-    "||=",
-    "^=",
-};
+int token_is(const Token t, const char* str);
+size_t token_copy(const Token t, char* buf, size_t size);
 
-static char delimiters[] = {
-    '}',
-    '{',
-    ']',
-    '[',
-    ')',
-    '(',
-    ',',
-    ';',
-};
+void print_error(Token token);
+void print_token(Token token);
 
-int is_keyword(char* str, int len);
-int is_operator(char* str, int len);
-int is_delimiter(char c);
+/* Lexer state
+ * Everything the lexer needs lives here rather than in globals, so any number
+ * of inputs can be lexed at once (one Lexer per input/thread).
+ * input is not required to be NUL-terminated, lexing stops at input + length
+ */
+typedef struct {
+    const char* input;
+    size_t length;
+    size_t pos;                 // Current position in input
+    int line;                   // Current line, starts at 1
+    size_t line_start;          // Position of the first character of the current line
+    int column;                 // Column of the last token lexed, starts at 1
+    TokenType last;             // Type of the last token lexed
+} Lexer;
 
-void print_error(ErrorType error, int line, const char *lexeme);
-void print_token(Token token);
+void lexer_init(Lexer* lexer, const char* input, size_t length);
+void skip_whitespace(Lexer* lexer);
+Token get_next_token(Lexer* lexer);
+void print_token_stream(const char* input, size_t length);
+
+// Lexes the whole input into one EOF-terminated table, large inputs are split
+// across threads. *count includes the EOF, returns NULL if out of memory.
+// Lexical errors are left in the tokens, nothing is printed
+Token* lex_table(const char* input, size_t length, size_t* count);
+
+/* Pull based token source
+ * Tokens are lexed on demand as they are consumed, only the last few are kept
+ * in a small ring so the parser can look ahead without a full token table.
+ * Inputs big enough to split are lexed up front in parallel instead, the ring
+ * is then filled from that table.
+ */
+typedef struct {
+    Lexer lexer;
+    Token ring[LOOKAHEAD];
+    int head;                   // Ring index of the next token to hand out
+    int count;                  // Number of buffered tokens
+    Token* table;               // Pre-lexed tokens, NULL when lexing on demand
+    size_t table_pos;
+    size_t table_count;
+} TokenStream;
 
-Token get_next_token(const char *input, int *pos, TokenType last_token_type);
-void print_token_stream(const char* input);
+void token_stream_init(TokenStream* stream, const char* input, size_t length);
+Token token_stream_next(TokenStream* stream);
+// Returns the token k positions ahead of the next one without consuming anything
+Token token_stream_peek(TokenStream* stream, int k);
+void token_stream_free(TokenStream* stream);
 #endif
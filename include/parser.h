@@ -2,7 +2,10 @@
 #define PARSER_H
 
 #include "tokens.h"
+#include "lexer.h"
+#include "arena.h"
 #include <string.h>
+#include <stdint.h>
 
 /*AST Node Types*/
 typedef enum {
@@ -21,11 +24,24 @@ typedef enum {
     AST_BINOP,
     AST_UNARYOP,
     AST_LITERAL,
-    AST_IDENTIFIER,
-    AST_FACTORIAL
+    AST_IDENTIFIER
 } ASTType;
 
+// Types the semantic checker resolves expressions to
+typedef enum {
+    TYPE_INT,
+    TYPE_UINT,
+    TYPE_FLOAT,
+    TYPE_STRING,
+    TYPE_CHAR,
+    TYPE_UNKNOWN,
+    TYPE_ERROR,         // The expression has an error that was already reported
+} DataType;
+
+#define VAR_NONE (-1)
+
 /*AST Node Structure*/
+// What the parser builds, parse() lays it out as a FlatAST and frees it
 typedef struct ASTNode {
     ASTType           type;
     Token             current;
@@ -35,54 +51,201 @@ typedef struct ASTNode {
     struct ASTNode   *body;
 } ASTNode;
 
+// Field of its parent a node hangs from
+typedef enum {
+    AST_SLOT_ROOT,
+    AST_SLOT_LEFT,
+    AST_SLOT_RIGHT,
+    AST_SLOT_BODY,
+    AST_SLOT_NEXT,
+} ASTSlot;
+
+/* Flat AST
+ * The tree every pass after the parser works on. Nodes are 32-bit indices
+ * into parallel arrays laid out in pre-order, so walking the whole tree is a
+ * linear scan. A node's first child is the node right after it, the others
+ * follow through next_sibling: the left, right and body fields of an ASTNode
+ * become one list of children in that order, each tagged with the field
+ * (slot) it came from, and a ->next list stays together as siblings tagged
+ * AST_SLOT_NEXT. The root is node 0.
+ * The parse takes 32 bytes a node, ASTNode is 80. The semantic checker keeps
+ * what it finds out about a node in the side arrays below, 6 more bytes.
+ */
+typedef uint32_t NodeId;
+#define NODE_NONE UINT32_MAX
+
+// info packs the node's ASTType, slot, token type/kind and a has-children bit
+#define FLAT_INFO(type, slot, ttype, tkind) \
+    ((uint32_t)(type) | (uint32_t)(slot) << 8 | (uint32_t)(ttype) << 11 | (uint32_t)(tkind) << 15)
+#define FLAT_TYPE(info)       ((ASTType)((info) & 0xff))
+#define FLAT_SLOT(info)       ((ASTSlot)(((info) >> 8) & 0x7))
+#define FLAT_TOKEN_TYPE(info) ((TokenType)(((info) >> 11) & 0xf))
+#define FLAT_TOKEN_KIND(info) ((TokenKind)(((info) >> 15) & 0xff))
+#define FLAT_HAS_CHILDREN     (1u << 23)
+
+// span_start of tokens that don't point into the source (the program node's),
+// their text is interned in aux instead
+#define FLAT_NO_SPAN UINT32_MAX
+
+// FlatAST.folded, set by constant folding (see fold.h)
+#define FOLD_CONSTANT   1       // Reads as an AST_LITERAL holding value, its children are gone
+#define FOLD_PROPAGATED 2       // Folded from a variable's known value rather than written
+
+typedef struct {
+    const char* source;         // Buffer the spans are offsets into
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* info;
+    uint32_t* span_start;       // Lexeme offset into source
+    uint32_t* span_length;
+    int32_t* line;
+    NodeId* next_sibling;       // NODE_NONE for the last child
+    InternId* aux;              // Interned lexeme of identifiers and strings
+    TokenValue* value;          // Numeric literals, and nodes folded into a constant
+    // Filled in by the semantic checker
+    uint8_t* data_type;         // DataType, bottom-up, TYPE_UNKNOWN until then
+    uint8_t* folded;            // FOLD_* flags
+    int32_t* var_index;         // Declaration an identifier, call or VarDecl resolves to, VAR_NONE until then
+} FlatAST;
+
+// Lays out the tree under root, returns -1 if out of memory
+int flat_ast_build(FlatAST* ast, const ASTNode* root, const char* source, size_t length);
+void flat_ast_free(FlatAST* ast);
+// Rebuilds the node's token
+Token flat_ast_token(const FlatAST* ast, NodeId node);
+// Index right after the last node under node
+NodeId flat_ast_end(const FlatAST* ast, NodeId node);
+
+static inline ASTType flat_type(const FlatAST* ast, NodeId node) {
+    return FLAT_TYPE(ast->info[node]);
+}
+
+static inline ASTSlot flat_slot(const FlatAST* ast, NodeId node) {
+    return FLAT_SLOT(ast->info[node]);
+}
+
+static inline TokenKind flat_kind(const FlatAST* ast, NodeId node) {
+    return FLAT_TOKEN_KIND(ast->info[node]);
+}
+
+static inline int flat_line(const FlatAST* ast, NodeId node) {
+    return ast->line[node];
+}
+
+static inline NodeId flat_first_child(const FlatAST* ast, NodeId node) {
+    return (ast->info[node] & FLAT_HAS_CHILDREN) ? node + 1 : NODE_NONE;
+}
+
+// What ASTNode had in the field slot, the head of the list there
+static inline NodeId flat_child(const FlatAST* ast, NodeId node, ASTSlot slot) {
+    NodeId child = flat_first_child(ast, node);
+    while (child != NODE_NONE && flat_slot(ast, child) != slot) child = ast->next_sibling[child];
+    return child;
+}
+
+static inline NodeId flat_left(const FlatAST* ast, NodeId node) {
+    return flat_child(ast, node, AST_SLOT_LEFT);
+}
+
+static inline NodeId flat_right(const FlatAST* ast, NodeId node) {
+    return flat_child(ast, node, AST_SLOT_RIGHT);
+}
+
+static inline NodeId flat_body(const FlatAST* ast, NodeId node) {
+    return flat_child(ast, node, AST_SLOT_BODY);
+}
+
+// ASTNode's ->next, the list goes on until a sibling from another field
+static inline NodeId flat_next(const FlatAST* ast, NodeId node) {
+    const NodeId sibling = ast->next_sibling[node];
+    return sibling != NODE_NONE && flat_slot(ast, sibling) == AST_SLOT_NEXT ? sibling : NODE_NONE;
+}
+
+/* AST walker
+ * Visits a node and everything below it depth first without recursion, the
+ * nodes the walk is in are kept on a heap stack so deep trees don't grow the
+ * C stack. Nodes come in pre-order, which is the order they are stored in:
+ * children in field order left, right, body, a ->next list after the node it
+ * hangs from, sharing its parent. The root's own siblings are not visited.
+ * pre runs on the way down and may skip the node's children (post still runs)
+ * or stop the walk, post runs once all the children are done. Either may be
+ * NULL.
+ */
+typedef enum {
+    WALK_CONTINUE,
+    WALK_SKIP,
+    WALK_STOP,
+} WalkAction;
+
+typedef struct {
+    NodeId node;
+    NodeId parent;              // NODE_NONE for the root
+    ASTSlot slot;               // Field of parent the node is in, AST_SLOT_NEXT past a list's head
+    int depth;
+} WalkFrame;
+
+typedef struct {
+    WalkAction (*pre)(const WalkFrame* frame, void* ctx);
+    void (*post)(const WalkFrame* frame, void* ctx);
+} ASTVisitor;
+
+// Returns 1 if a callback stopped the walk, -1 if out of memory, 0 otherwise
+int ast_walk(const FlatAST* ast, NodeId root, const ASTVisitor* visitor, void* ctx);
+
 /*Prototypes*/
-ASTNode* create_node(ASTType type, const Token* tk);
-Token* make_table(char* input);
+Token* make_table(const char* input, size_t length);
 void parse_table(Token* table);
-void print_ast(ASTNode* root);
+void print_ast(const FlatAST* ast);
 
 static const char* ast_type_to_string(ASTType type);
 
 
-int isKeyword(const Token t, const char *kw);
-int isOperator(const Token t, const char *op);
-int isDelimiter(const Token t, const char *delim);
-int get_precedence(const char* op);
-
-static const char* TYPES[] = {"int", "uint", "string", "float", "char"};
-static const char* KEYWORDS[] = {"while", "repeat", "for"};
-static const char* ASSIGNMENTS[] = {"=", "+=", "-=", "/=", "*=", "%=", "&=", "|=", "<<=", ">>="};
+int isKeyword(const Token t, TokenKind kw);
+int isOperator(const Token t, TokenKind op);
+int isDelimiter(const Token t, TokenKind delim);
 
-static const char* UNARY[] = { "++", "--", "~", "!", };
-static const char* FACTOR[] = { "*", "/", "%"};
-static const char* ADD_SUB[] = { "+", "-"};
-static const char* BITSHIFTS[] = { "<<", ">>"};
-static const char* COMPARISON[] = { "<=", "=>", "<", ">"};
-static const char* EQUALITY[] = { "!=", "==" };
-static const char* BITAND[] = { "&" };
-static const char* BITXOR[] = { "^" };
-static const char* BITOR[] = { "|" };
-static const char* LOGAND[] = { "&&" };
-static const char* LOGOR[] = { "||" };
 
-int str_is_in(const char* str, const char* arr[], int num);
+// An operator waiting on the expression stack for its right operand
+typedef struct {
+    Token op;
+    unsigned char rbp;          // Binding power towards the operand on its right
+    unsigned char prefix;       // Unary, reduces with a single operand
+} PendingOp;
 
+/* Operand and operator stacks of parse_expression, kept in the parser and
+ * reused so long expressions don't recurse. A nested expression (parentheses,
+ * call arguments) works on top of what its caller left there.
+ */
+typedef struct {
+    ASTNode** operands;
+    size_t operand_count;
+    size_t operand_capacity;
+    PendingOp* operators;
+    size_t operator_count;
+    size_t operator_capacity;
+} ExprStack;
 
 typedef struct _Parser {
-    Token* tokens;
+    TokenStream tokens;
     Token current;
-    int position;
     int scope_level;
-    ASTNode* root;
+    ASTNode* root;              // NULL once parsing is done, see ast
+    Arena arena;                // Owns every node of the AST
+    FlatAST ast;                // Built from root once parsing is done
+    ExprStack expr;
+    int errors;                 // Syntax errors reported so far
 } Parser;
 
-Parser new_parser(char* input);
+// Nodes live in the parser's arena until parse() has laid them out flat
+ASTNode* create_node(Parser* parser, ASTType type, const Token* tk);
+
+Parser new_parser(const char* input, size_t length);
 int parse(Parser* parser);
 void free_parser(Parser parser);
 void advance(Parser* parser);
 
 ASTNode* parse_program(Parser* parser);
-ASTNode* parse_expression(Parser* parser, int min_precedence);
+ASTNode* parse_expression(Parser* parser, int min_bp);
 ASTNode* parse_declaration(Parser* parser);
 ASTNode* parse_assignment(Parser* parser, ASTNode* lhs);
 ASTNode* parse_block(Parser* parser);
@@ -93,7 +256,6 @@ ASTNode* parse_print_statement(Parser* parser);
 ASTNode* parse_statement(Parser* parser);
 ASTNode* parse_primary(Parser* parser);
 ASTNode* parse_function_args(Parser* parser);
-ASTNode* parse_factorial(Parser* parser);
 
 // Define the enum and its string conversion function
 // might be good to add a custom
@@ -122,11 +284,12 @@ static const char* error_to_string(ParserErrorType e) {
 }
 
 
+// Both count the error in the parser, see Parser.errors
 #define PARSE_ERROR(parser, error_type, message, ...)\
-    fprintf(stderr, "\n[PARSER ERROR] Error near token '%s' on line %d; \n\t Error: %s " message "\n", parser->current.lexeme, parser->current.line, error_to_string(error_type), ##__VA_ARGS__);\
+    ((parser)->errors++, fprintf(stderr, "\n[PARSER ERROR] Error near token '" TOKEN_FMT "' on line %d; \n\t Error: %s " message "\n", TOKEN_ARG(parser->current), parser->current.line, error_to_string(error_type), ##__VA_ARGS__));\
 
 #define PARSE_ERROR_S(parser, error_type, ...)\
-    fprintf(stderr, "\n[PARSER ERROR] Error near token '%s' on line %d; \n\t Error: %s\n", parser->current.lexeme, parser->current.line, error_to_string(error_type), ##__VA_ARGS__);\
+    ((parser)->errors++, fprintf(stderr, "\n[PARSER ERROR] Error near token '" TOKEN_FMT "' on line %d; \n\t Error: %s\n", TOKEN_ARG(parser->current), parser->current.line, error_to_string(error_type), ##__VA_ARGS__));\
 
 
 //#define DEBUG
@@ -136,7 +299,4 @@ static const char* error_to_string(ParserErrorType e) {
 #define PARSE_INFO(message, ...)
 #endif
 
-#define CONTAINS_STR(val, str)\
-    str_is_in(str, val, sizeof(val)/sizeof(*val))
-
 #endif
@@ -0,0 +1,36 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* Fixed size object pool
+ * Objects are carved out of slabs holding many of them. A released object
+ * goes on a free list and is handed out again before the slab is touched.
+ * pool_reset() forgets every object at once in O(1) and keeps the slabs, so
+ * the next round of allocations reuses the same memory.
+ */
+typedef struct PoolSlab {
+    struct PoolSlab* next;
+    max_align_t data[];
+} PoolSlab;
+
+typedef struct {
+    size_t object_size;     // Rounded up so every object stays aligned
+    size_t per_slab;        // Objects per slab
+    PoolSlab* first;
+    PoolSlab* slab;         // Slab currently allocated from, NULL before the first allocation
+    size_t used;            // Objects handed out from slab
+    void* free_list;        // Released objects, linked through their first bytes
+} Pool;
+
+#define POOL_SLAB_OBJECTS 256
+
+void pool_init(Pool* pool, size_t object_size, size_t per_slab);
+// Returns an uninitialized object, NULL if out of memory
+void* pool_alloc(Pool* pool);
+void pool_release(Pool* pool, void* object);
+// Releases every object without freeing the slabs
+void pool_reset(Pool* pool);
+void pool_free(Pool* pool);
+
+#endif
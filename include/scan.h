@@ -0,0 +1,35 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Byte scanners for the lexer's hot loops
+ * Each scanner starts at input[pos] and returns the position of the first byte
+ * that ends the run, or length if the run reaches the end of the input. The
+ * ones that can cross newlines bump *line and move *line_start past the last
+ * '\n' they consumed, exactly like next_line() would have.
+ *
+ * The implementation (scalar, SSE2 or AVX2) is picked once at startup from what
+ * the CPU supports, all of them return identical results.
+ */
+typedef struct {
+    const char* name;
+    // Skips ' ', '\t' and '\n'
+    size_t (*space)(const char* input, size_t pos, size_t length, int* line, size_t* line_start);
+    // Stops at the '*' of the closing "*/" of a block comment
+    size_t (*comment)(const char* input, size_t pos, size_t length, int* line, size_t* line_start);
+    // Stops at the next '\n', used for line comments
+    size_t (*to_newline)(const char* input, size_t pos, size_t length);
+    // Skips [A-Za-z0-9_]
+    size_t (*ident)(const char* input, size_t pos, size_t length);
+    // Stops at '"', '\\' or '\n' inside a string literal
+    size_t (*string)(const char* input, size_t pos, size_t length);
+} Scanner;
+
+extern Scanner scanner;
+
+// Forces a specific implementation ("scalar", "sse2", "avx2"),
+// returns -1 if it is unknown or the CPU can't run it
+int scan_use(const char* name);
+
+#endif
@@ -2,16 +2,11 @@
 #define SEMANTIC_H
 
 #include "parser.h"
+#include "pool.h"
 
-// Define DataType enum first
-typedef enum {
-    TYPE_INT,
-    TYPE_UINT,
-    TYPE_FLOAT,
-    TYPE_STRING,
-    TYPE_CHAR,
-    TYPE_UNKNOWN
-} DataType;
+// Function bodies are checked in parallel with one thread per this many top
+// level functions (up to the core count)
+#define PARALLEL_MIN_FUNCTIONS 64
 
 // Type compatibility result
 typedef enum {
@@ -21,18 +16,55 @@ typedef enum {
 } TypeCompatibility;
 
 // Symbol table structures
-typedef struct Symbol {
-    char name[100];
-    DataType type;  // Now DataType is defined before use
+// Every declaration gets a variable record. Unlike its Symbol it outlives the
+// scope, until the table is reset, so the AST refers to it by var_index
+typedef struct {
+    InternId name;
+    DataType type;
     int scope_level;
     int line_declared;
-    int is_initialized;
-    struct Symbol* next;
+} Variable;
+
+// Pool allocated, fields ordered so a record is 32 bytes
+typedef struct Symbol {
+    struct Symbol* next;        // Previously declared live symbol, any name
+    struct Symbol* shadowed;    // Outer symbol with the same name this one hides
+    InternId name;      // Interned identifier, see intern_text()
+    int scope_level;
+    int var_index;              // Its record in SymbolTable.variables
+    unsigned char type;         // DataType
+    unsigned char is_initialized;
 } Symbol;
 
+// A name keeps its slot once used, symbol is NULL while none of its declarations is live.
+// Slots from an older epoch are empty, that's how the table is reset
+typedef struct {
+    InternId name;
+    uint32_t epoch;
+    Symbol* symbol;
+} SymbolSlot;
+
+/* Symbol table
+ * Live symbols form a stack (head, ->next) in declaration order. An open
+ * addressing table maps each name to its innermost live symbol, which links
+ * to the ones it shadows, so a lookup is a single probe sequence. Every
+ * scope records the head it started at and exiting it pops back to there.
+ * Symbols come from a pool, reset_symbol_table() empties the whole table in
+ * O(1) for the next compilation.
+ */
 typedef struct {
     Symbol* head;
     int current_scope;
+    SymbolSlot* slots;
+    uint32_t capacity;          // Always a power of two
+    uint32_t used;              // Slots holding a name this epoch
+    uint32_t epoch;
+    Symbol** scope_marks;       // head when each open scope was entered
+    int scope_capacity;
+    Pool symbols;
+    Variable* variables;        // Indexed by var_index, in declaration order
+    int variable_count;
+    int variable_capacity;
 } SymbolTable;
 
 // Semantic error types
@@ -48,33 +80,34 @@ typedef enum {
 
 // Symbol table functions
 SymbolTable* init_symbol_table(void);
-Symbol* add_symbol(SymbolTable* table, const char* name, int type, int line);
+Symbol* add_symbol(SymbolTable* table, const Token name, int type, int line);
 void add_arg(Symbol* symbol, Symbol* arg);
-Symbol* lookup_symbol(SymbolTable* table, const char* name);
-Symbol* lookup_symbol_current_scope(SymbolTable* table, const char* name);
+Symbol* lookup_symbol(SymbolTable* table, const Token name);
+Symbol* lookup_symbol_current_scope(SymbolTable* table, const Token name);
 void enter_scope(SymbolTable* table);
 void exit_scope(SymbolTable* table);
 void remove_symbols_in_current_scope(SymbolTable* table);
+void reset_symbol_table(SymbolTable* table);
 void free_symbol_table(SymbolTable* table);
 void print_symbol_table(SymbolTable* table);
 
 // Semantic analysis functions
-int analyze_semantics(ASTNode* ast);
-int check_declaration(ASTNode* node, SymbolTable* table);
-int check_args(ASTNode* node, SymbolTable* table);
-int check_program(ASTNode* node, SymbolTable* table);
-int check_assignment(ASTNode* node, SymbolTable* table);
-int check_expression(ASTNode* node, SymbolTable* table);
-int check_statement(ASTNode* node, SymbolTable* table);
-int check_block(ASTNode* node, SymbolTable* table);
-int check_condition(ASTNode* node, SymbolTable* table);
+// The checks run as one ast_walk over the tree, see semantic.c. Function
+// bodies of large programs are checked in parallel, with the same output
+// Types, resolutions and folds go in the AST's side arrays
+int analyze_semantics(FlatAST* ast);
+// Same with a caller owned table, reset before it is used
+int analyze_semantics_with(FlatAST* ast, SymbolTable* table);
+// Checks the tree under node
+int check_program(FlatAST* ast, NodeId node, SymbolTable* table);
 
 // Error reporting
 void semantic_error(SemanticErrorType error, const char* name, int line);
+void semantic_error_token(SemanticErrorType error, const Token name, int line);
 
 // Type checking utility functions
 TypeCompatibility check_type_compatibility(DataType left, DataType right);
-DataType get_result_type(DataType left, DataType right, const char* operator);
-DataType get_expression_type(ASTNode* node, SymbolTable* table);
+DataType get_result_type(DataType left, DataType right, TokenKind operator);
+DataType get_expression_type(FlatAST* ast, NodeId node, SymbolTable* table);
 
 #endif // SEMANTIC_H
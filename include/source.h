@@ -0,0 +1,30 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
+
+/* Source input buffer
+ * Regular files are memory-mapped read-only so the lexer runs directly over the
+ * mapped bytes. Pipes and stdin can't be mapped, so they are streamed into a
+ * growable heap buffer instead, as is everything on platforms without mmap
+ * (HAVE_MMAP).
+ * The data is NOT guaranteed to be NUL-terminated, always go by length.
+ */
+// Token lengths and line numbers are int, longer inputs are refused
+#define SOURCE_MAX_LENGTH ((size_t)INT_MAX)
+
+typedef struct {
+    const char* data;
+    size_t length;
+    int mapped;     // 1 if data came from mmap, 0 if it is heap allocated
+} SourceBuffer;
+
+// Opens path ("-" means stdin), returns 0 on success and -1 on failure
+int source_open(SourceBuffer* src, const char* path);
+// Reads a whole stream (pipe, stdin, ...) into a heap buffer
+int source_from_stream(SourceBuffer* src, FILE* fp);
+void source_close(SourceBuffer* src);
+
+#endif
@@ -6,6 +6,8 @@
 #ifndef TOKENS_H
 #define TOKENS_H
 
+#include "intern.h"
+
 /* Token types that need to be recognized by the lexer
  * TODO: Add more token types as per requirements:
  * - Keywords or reserved words (if, repeat, until)
@@ -18,7 +20,7 @@ typedef enum {
     TOKEN_EOF,
     TOKEN_NUMBER,       // e.g., "123", "456"
     TOKEN_STRING,
-    TOKEN_FLOAT,
+    TOKEN_FLOAT,        // e.g., "3.14", "2."
     TOKEN_IDENTIFIER,   // e.g
     TOKEN_OPERATOR,     // e.g., "+", "-", "="
     TOKEN_KEYWORD,         // e.g., string, int, uint
@@ -27,6 +29,95 @@ typedef enum {
     TOKEN_NONE,
 } TokenType;
 
+/* Token kinds
+ * Keywords, operators and delimiters are resolved to a kind once by the lexer,
+ * so later phases compare integers instead of lexemes. Identifiers, literals
+ * and EOF have kind KIND_NONE.
+ * Order matters: the type keywords and the assignment operators are kept
+ * contiguous so IS_TYPE_KIND/IS_ASSIGN_KIND are range checks.
+ */
+#define KEYWORD_KINDS \
+    X(KW_INT,       "int")\
+    X(KW_UINT,      "uint")\
+    X(KW_FLOAT,     "float")\
+    X(KW_STRING,    "string")\
+    X(KW_CHAR,      "char")\
+    X(KW_OBJECT,    "object")\
+    X(KW_IF,        "if")\
+    X(KW_ELSE,      "else")\
+    X(KW_FOR,       "for")\
+    X(KW_WHILE,     "while")\
+    X(KW_LOOP,      "loop")\
+    X(KW_BREAK,     "break")\
+    X(KW_PRINT,     "print")\
+    X(KW_RETURN,    "return")\
+    X(KW_FN,        "fn")\
+    X(KW_REPEAT,    "repeat")\
+    X(KW_UNTIL,     "until")
+
+#define OPERATOR_KINDS \
+    X(OP_EQ,            "==")\
+    X(OP_NOT,           "!")\
+    X(OP_NE,            "!=")\
+    X(OP_GT,            ">")\
+    X(OP_GE,            ">=")\
+    X(OP_LT,            "<")\
+    X(OP_LE,            "<=")\
+    X(OP_ADD,           "+")\
+    X(OP_SUB,           "-")\
+    X(OP_MUL,           "*")\
+    X(OP_DIV,           "/")\
+    X(OP_MOD,           "%")\
+    X(OP_SHR,           ">>")\
+    X(OP_SHL,           "<<")\
+    X(OP_BITAND,        "&")\
+    X(OP_AND,           "&&")\
+    X(OP_BITOR,         "|")\
+    X(OP_OR,            "||")\
+    X(OP_XOR,           "^")\
+    X(OP_BITNOT,        "~")\
+    X(OP_INC,           "++")\
+    X(OP_DEC,           "--")\
+    X(OP_ASSIGN,        "=")\
+    X(OP_ADD_ASSIGN,    "+=")\
+    X(OP_SUB_ASSIGN,    "-=")\
+    X(OP_MUL_ASSIGN,    "*=")\
+    X(OP_DIV_ASSIGN,    "/=")\
+    X(OP_MOD_ASSIGN,    "%=")\
+    X(OP_SHR_ASSIGN,    ">>=")\
+    X(OP_SHL_ASSIGN,    "<<=")\
+    X(OP_BITAND_ASSIGN, "&=")\
+    X(OP_AND_ASSIGN,    "&&=")\
+    X(OP_BITOR_ASSIGN,  "|=")\
+    X(OP_OR_ASSIGN,     "||=")\
+    X(OP_XOR_ASSIGN,    "^=")
+
+#define DELIMITER_KINDS \
+    X(DELIM_RBRACE,     "}")\
+    X(DELIM_LBRACE,     "{")\
+    X(DELIM_RBRACKET,   "]")\
+    X(DELIM_LBRACKET,   "[")\
+    X(DELIM_RPAREN,     ")")\
+    X(DELIM_LPAREN,     "(")\
+    X(DELIM_COMMA,      ",")\
+    X(DELIM_SEMICOLON,  ";")
+
+typedef enum {
+    KIND_NONE,
+    #define X(kind, text) kind,
+    KEYWORD_KINDS
+    OPERATOR_KINDS
+    DELIMITER_KINDS
+    #undef X
+    KIND_COUNT
+} TokenKind;
+
+#define IS_TYPE_KIND(k) ((k) >= KW_INT && (k) <= KW_CHAR)
+#define IS_ASSIGN_KIND(k) ((k) >= OP_ASSIGN && (k) <= OP_XOR_ASSIGN)
+// Operators that may start an operand, so they can follow another operator
+#define IS_PREFIX_KIND(k) ((k) == OP_ADD || (k) == OP_SUB || (k) == OP_NOT || \
+                           ((k) >= OP_BITNOT && (k) <= OP_DEC))
+
 /* Error types for lexical analysis
  * TODO: Add more error types as needed for your language - as much as you like !!
  */
@@ -35,7 +126,10 @@ typedef enum {
     ERROR_INVALID_CHAR,
     ERROR_INVALID_NUMBER,
     ERROR_UNKNOWN_TYPE,
-    ERROR_CONSECUTIVE_OPERATORS
+    ERROR_CONSECUTIVE_OPERATORS,
+    ERROR_UNTERMINATED_STRING,
+    ERROR_INVALID_ESCAPE,
+    ERROR_NUMBER_OVERFLOW
 } ErrorType;
 
 /* Token structure to store token information
@@ -43,11 +137,32 @@ typedef enum {
  * Hint: You might want to consider adding line and column tracking if you want to debug your lexer properly.
  * Don't forget to update the token fields in lexer.c as well
  */
+/* The lexeme is not copied into the token, it is a span [start, start + length)
+ * of the source buffer (string literals span the text between the quotes).
+ * It is NOT NUL-terminated: print it with TOKEN_FMT/TOKEN_ARG, compare it with
+ * token_is, or materialize it with token_copy when a C string is needed.
+ */
+/* Numeric literals are decoded once by the lexer, later phases read the value
+ * instead of parsing the lexeme again. Literals carry no sign, a '-' in front
+ * is a separate operator token.
+ */
+typedef union {
+    unsigned long long u;   // TOKEN_NUMBER
+    double f;               // TOKEN_FLOAT
+} TokenValue;
+
 typedef struct {
     TokenType type;
-    char lexeme[100];   // Actual text of the token
-    int line;           // Line number in source file
+    TokenKind kind;     // Keyword/operator/delimiter kind, KIND_NONE otherwise
     ErrorType error;    // Error type if any
+    InternId id;        // Interned lexeme of identifiers and string literals, INTERN_NONE otherwise
+    const char* start;  // Start of the lexeme in the source buffer
+    int length;         // Length of the lexeme
+    int line;           // Line number in source file
+    TokenValue value;   // Decoded value of number/float literals, 0 otherwise
 } Token;
 
+#define TOKEN_FMT "%.*s"
+#define TOKEN_ARG(t) (t).length, (t).start
+
 #endif /* TOKENS_H */
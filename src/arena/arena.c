@@ -0,0 +1,44 @@
+#include "arena.h"
+#include <stdlib.h>
+
+#define ALIGN(n) (((n) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+void arena_init(Arena* arena, size_t block_size) {
+    arena->block = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = ALIGN(size);
+    ArenaBlock* block = arena->block;
+    if (!block || block->used + size > block->size) {
+        size_t capacity = size > arena->block_size ? size : arena->block_size;
+        ArenaBlock* fresh = malloc(sizeof(ArenaBlock) + capacity);
+        if (!fresh) return NULL;
+        fresh->used = 0;
+        fresh->size = capacity;
+        if (block && size > arena->block_size) {
+            // oversized request, slip it in behind the current block so
+            // the remaining space there is still used
+            fresh->prev = block->prev;
+            block->prev = fresh;
+        } else {
+            fresh->prev = block;
+            arena->block = fresh;
+        }
+        block = fresh;
+    }
+    void* ptr = (char*)block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    while (block) {
+        ArenaBlock* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    arena->block = NULL;
+}
@@ -0,0 +1,59 @@
+#include "pool.h"
+#include <stdlib.h>
+
+#define ALIGN(n) (((n) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+void pool_init(Pool* pool, size_t object_size, size_t per_slab) {
+    // a free object holds the free list link
+    if (object_size < sizeof(void*)) object_size = sizeof(void*);
+    pool->object_size = ALIGN(object_size);
+    pool->per_slab = per_slab ? per_slab : POOL_SLAB_OBJECTS;
+    pool->first = NULL;
+    pool->slab = NULL;
+    pool->used = 0;
+    pool->free_list = NULL;
+}
+
+void* pool_alloc(Pool* pool) {
+    if (pool->free_list) {
+        void* object = pool->free_list;
+        pool->free_list = *(void**)object;
+        return object;
+    }
+    if (!pool->slab || pool->used == pool->per_slab) {
+        // after a reset the slabs are still chained, walk on before allocating
+        PoolSlab* next = pool->slab ? pool->slab->next : pool->first;
+        if (!next) {
+            next = malloc(sizeof(PoolSlab) + pool->object_size * pool->per_slab);
+            if (!next) return NULL;
+            next->next = NULL;
+            if (pool->slab) pool->slab->next = next;
+            else pool->first = next;
+        }
+        pool->slab = next;
+        pool->used = 0;
+    }
+    return (char*)pool->slab->data + pool->object_size * pool->used++;
+}
+
+void pool_release(Pool* pool, void* object) {
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+}
+
+void pool_reset(Pool* pool) {
+    pool->slab = NULL;
+    pool->used = 0;
+    pool->free_list = NULL;
+}
+
+void pool_free(Pool* pool) {
+    PoolSlab* slab = pool->first;
+    while (slab) {
+        PoolSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->first = NULL;
+    pool_reset(pool);
+}
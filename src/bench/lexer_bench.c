@@ -0,0 +1,113 @@
+/* lexer_bench.c
+ * Measures lexer throughput in MB/s.
+ *
+ *   ./lexer_bench                  lexes a generated ~16 MB program
+ *   ./lexer_bench path/to/file     lexes the given file
+ *   ./lexer_bench path/to/file N   ... N times (default 5), reports the best run
+ * Each scanner implementation the CPU supports is measured separately, then the
+ * whole input is lexed into a table with lex_table() (parallel on big inputs).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lexer.h"
+#include "source.h"
+#include "scan.h"
+
+#define GENERATED_SIZE (16 * 1024 * 1024)
+
+static double now_seconds(void) {
+    struct timespec ts;
+    // C11, so it also builds where clock_gettime doesn't exist
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Builds a program that looks like our generated sources: declarations,
+// arithmetic, control flow and a lot of comments
+static char* generate_input(size_t size, size_t* length) {
+    static const char* lines[] = {
+        "// generated helper, do not edit by hand\n",
+        "int value_%d = 123 + 456 * counter - 789;\n",
+        "/* block comment describing the next statement\n   spanning a couple of lines */\n",
+        "string label_%d = \"some string literal with \\\"escapes\\\"\\n\";\n",
+        "if (value_%d >= 10 && flag != 0) { print value_%d; }\n",
+        "while (index_%d < 100) { index_%d += 1; total = total * 2 / 3 % 7; }\n",
+        "float ratio_%d = 3.14159 * radius;\n",
+        "    \t    \n",
+    };
+    const size_t num_lines = sizeof(lines) / sizeof(*lines);
+    char* buf = malloc(size + 256);
+    size_t len = 0;
+    int n = 0;
+    while (len < size) {
+        const char* fmt = lines[n % num_lines];
+        len += (size_t)snprintf(buf + len, 256, fmt, n, n);
+        n++;
+    }
+    *length = len;
+    return buf;
+}
+
+int main(int argc, char* argv[]) {
+    SourceBuffer source = {0};
+    char* generated = NULL;
+    int runs = 5;
+
+    if (argc >= 2) {
+        if (source_open(&source, argv[1]) != 0) {
+            fprintf(stderr, "Failed to read %s\n", argv[1]);
+            return 1;
+        }
+        if (argc >= 3) runs = atoi(argv[2]);
+    } else {
+        generated = generate_input(GENERATED_SIZE, &source.length);
+        source.data = generated;
+    }
+
+    static const char* scanners[] = {"scalar", "sse2", "avx2"};
+    double mb = source.length / (1024.0 * 1024.0);
+    printf("%.2f MB, best of %d runs\n", mb, runs);
+
+    for (size_t i = 0; i < sizeof(scanners) / sizeof(*scanners); i++) {
+        if (scan_use(scanners[i]) != 0) continue;
+
+        double best = 0;
+        size_t tokens = 0;
+        for (int r = 0; r < runs; r++) {
+            Lexer lexer;
+            Token token;
+            lexer_init(&lexer, source.data, source.length);
+            tokens = 0;
+
+            double start = now_seconds();
+            do {
+                token = get_next_token(&lexer);
+                tokens++;
+            } while (token.type != TOKEN_EOF);
+            double elapsed = now_seconds() - start;
+
+            if (r == 0 || elapsed < best) best = elapsed;
+        }
+        printf("  %-7s %zu tokens, %.3f s, %.1f MB/s, %.1f Mtokens/s\n",
+                scanners[i], tokens, best, mb / best, tokens / best / 1e6);
+    }
+
+    double best = 0;
+    size_t tokens = 0;
+    for (int r = 0; r < runs; r++) {
+        double start = now_seconds();
+        Token* table = lex_table(source.data, source.length, &tokens);
+        double elapsed = now_seconds() - start;
+        free(table);
+
+        if (r == 0 || elapsed < best) best = elapsed;
+    }
+    printf("  table   %zu tokens, %.3f s, %.1f MB/s, %.1f Mtokens/s\n",
+            tokens, best, mb / best, tokens / best / 1e6);
+
+    if (generated) free(generated);
+    else source_close(&source);
+    return 0;
+}
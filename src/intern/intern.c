@@ -0,0 +1,200 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#define LOCK(shard)   pthread_mutex_lock(&(shard)->lock)
+#define UNLOCK(shard) pthread_mutex_unlock(&(shard)->lock)
+#else
+// single threaded build, nothing to lock
+#define LOCK(shard)   ((void)0)
+#define UNLOCK(shard) ((void)0)
+#endif
+
+/* The interner is split into shards by hash, each with its own lock, so
+ * lexer threads interning different names rarely wait on each other.
+ * Each shard has an open addressing table of entry numbers tagged with their
+ * hash, so probing rarely touches an entry that doesn't match. The entries
+ * themselves live in fixed size pages that never move once allocated, so an
+ * ID handed out stays valid while other threads keep interning.
+ *
+ * An ID encodes (entry number << SHARD_BITS | shard) + 1.
+ */
+#define SHARD_BITS 4
+#define NUM_SHARDS (1 << SHARD_BITS)
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define MAX_PAGES 4096
+#define INITIAL_SLOTS 1024
+#define BLOCK_SIZE 65536
+
+typedef struct {
+    const char* text;
+    size_t length;
+} Entry;
+
+// String storage, blocks are chained through their first bytes
+typedef struct Block {
+    struct Block* prev;
+    char data[];
+} Block;
+
+typedef struct {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+    uint64_t* slots;        // hash << 32 | (entry number + 1), 0 when empty
+    uint32_t capacity;      // always a power of two
+    uint32_t count;
+    Entry* pages[MAX_PAGES];
+    Block* block;
+    size_t block_used;
+    size_t block_size;
+} Shard;
+
+#ifdef HAVE_PTHREAD
+static Shard shards[NUM_SHARDS] = {
+    [0 ... NUM_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+#else
+static Shard shards[NUM_SHARDS];
+#endif
+
+// FNV-1a
+static inline uint32_t hash_string(const char* str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline Entry* entry_at(Shard* shard, uint32_t index) {
+    return &shard->pages[index >> PAGE_BITS][index & (PAGE_SIZE - 1)];
+}
+
+static const char* store_text(Shard* shard, const char* str, size_t length) {
+    size_t needed = length + 1;
+    if (!shard->block || shard->block_used + needed > shard->block_size) {
+        size_t size = needed > BLOCK_SIZE / 4 ? needed : BLOCK_SIZE;
+        Block* block = malloc(sizeof(Block) + size);
+        if (!block) return NULL;
+        block->prev = shard->block;
+        shard->block = block;
+        shard->block_used = 0;
+        shard->block_size = size;
+    }
+    char* text = shard->block->data + shard->block_used;
+    memcpy(text, str, length);
+    text[length] = '\0';
+    shard->block_used += needed;
+    return text;
+}
+
+static int grow_slots(Shard* shard) {
+    uint32_t capacity = shard->capacity ? shard->capacity * 2 : INITIAL_SLOTS;
+    uint64_t* slots = calloc(capacity, sizeof(uint64_t));
+    if (!slots) return -1;
+    for (uint32_t i = 0; i < shard->capacity; i++) {
+        uint64_t slot = shard->slots[i];
+        if (!slot) continue;
+        uint32_t j = (uint32_t)(slot >> 32) & (capacity - 1);
+        while (slots[j]) j = (j + 1) & (capacity - 1);
+        slots[j] = slot;
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+    return 0;
+}
+
+InternId intern(const char* str, size_t length) {
+    uint32_t hash = hash_string(str, length);
+    uint32_t shard_index = hash >> (32 - SHARD_BITS);
+    Shard* shard = &shards[shard_index];
+    InternId id = INTERN_NONE;
+
+    LOCK(shard);
+    // keep the table at most half full
+    if (shard->count * 2 >= shard->capacity && grow_slots(shard) != 0) goto done;
+
+    uint32_t i = hash & (shard->capacity - 1);
+    for (; shard->slots[i]; i = (i + 1) & (shard->capacity - 1)) {
+        if ((uint32_t)(shard->slots[i] >> 32) != hash) continue;
+        uint32_t index = (uint32_t)shard->slots[i] - 1;
+        Entry* entry = entry_at(shard, index);
+        if (entry->length == length && memcmp(entry->text, str, length) == 0) {
+            id = (index << SHARD_BITS | shard_index) + 1;
+            goto done;
+        }
+    }
+
+    uint32_t index = shard->count;
+    if ((index >> PAGE_BITS) >= MAX_PAGES) goto done;
+    if (!shard->pages[index >> PAGE_BITS]) {
+        shard->pages[index >> PAGE_BITS] = malloc(sizeof(Entry) * PAGE_SIZE);
+        if (!shard->pages[index >> PAGE_BITS]) goto done;
+    }
+    const char* text = store_text(shard, str, length);
+    if (!text) goto done;
+
+    Entry* entry = entry_at(shard, index);
+    entry->text = text;
+    entry->length = length;
+    shard->slots[i] = (uint64_t)hash << 32 | (index + 1);
+    shard->count++;
+    id = (index << SHARD_BITS | shard_index) + 1;
+
+done:
+    UNLOCK(shard);
+    return id;
+}
+
+static Entry* lookup_id(InternId id) {
+    if (id == INTERN_NONE) return NULL;
+    uint32_t x = id - 1;
+    return entry_at(&shards[x & (NUM_SHARDS - 1)], x >> SHARD_BITS);
+}
+
+const char* intern_text(InternId id) {
+    Entry* entry = lookup_id(id);
+    return entry ? entry->text : "";
+}
+
+size_t intern_length(InternId id) {
+    Entry* entry = lookup_id(id);
+    return entry ? entry->length : 0;
+}
+
+size_t intern_count(void) {
+    size_t count = 0;
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        LOCK(&shards[i]);
+        count += shards[i].count;
+        UNLOCK(&shards[i]);
+    }
+    return count;
+}
+
+void intern_free(void) {
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        Shard* shard = &shards[i];
+        LOCK(shard);
+        for (int p = 0; p < MAX_PAGES && shard->pages[p]; p++) {
+            free(shard->pages[p]);
+            shard->pages[p] = NULL;
+        }
+        while (shard->block) {
+            Block* prev = shard->block->prev;
+            free(shard->block);
+            shard->block = prev;
+        }
+        free(shard->slots);
+        shard->slots = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+        shard->block_used = 0;
+        shard->block_size = 0;
+        UNLOCK(shard);
+    }
+}
@@ -0,0 +1,396 @@
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void* ir_grow(void* array, uint32_t* capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity) return array;
+    uint32_t grown_capacity = *capacity ? *capacity : 8;
+    while (grown_capacity < needed) grown_capacity *= 2;
+    void* grown = realloc(array, size * grown_capacity);
+    if (!grown) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    *capacity = grown_capacity;
+    return grown;
+}
+
+IrBlockId ir_new_block(IrFunction* fn) {
+    IrBlock block;
+    memset(&block, 0, sizeof(IrBlock));
+    IR_PUSH(fn->blocks, fn->block_count, fn->block_capacity, block);
+    return fn->block_count - 1;
+}
+
+static IrValue new_inst(IrFunction* fn, IrBlockId block, IrInst inst) {
+    inst.block = block;
+    IR_PUSH(fn->insts, fn->inst_count, fn->inst_capacity, inst);
+    return fn->inst_count - 1;
+}
+
+IrValue ir_emit(IrFunction* fn, IrBlockId block, IrInst inst) {
+    IrValue v = new_inst(fn, block, inst);
+    IrBlock* b = &fn->blocks[block];
+    IR_PUSH(b->insts, b->count, b->capacity, v);
+    return v;
+}
+
+// The operands are added by the caller, see ir_add_operands
+IrValue ir_emit_phi(IrFunction* fn, IrBlockId block, DataType type, int var) {
+    IrInst inst;
+    memset(&inst, 0, sizeof(IrInst));
+    inst.op = IR_PHI;
+    inst.type = type;
+    inst.a = inst.b = IR_NONE;
+    inst.var = var;
+    IrValue v = new_inst(fn, block, inst);
+    IrBlock* b = &fn->blocks[block];
+    IR_PUSH(b->phis, b->phi_count, b->phi_capacity, v);
+    return v;
+}
+
+void ir_add_pred(IrFunction* fn, IrBlockId block, IrBlockId pred) {
+    IrBlock* b = &fn->blocks[block];
+    IR_PUSH(b->preds, b->pred_count, b->pred_capacity, pred);
+}
+
+// Reserves count operands in a row, returns the first
+uint32_t ir_add_operands(IrFunction* fn, uint32_t count) {
+    uint32_t first = fn->operand_count;
+    fn->operands = ir_grow(fn->operands, &fn->operand_capacity, first + count, sizeof(IrValue));
+    for (uint32_t i = 0; i < count; i++) {
+        fn->operands[first + i] = IR_NONE;
+    }
+    fn->operand_count += count;
+    return first;
+}
+
+int ir_successors(const IrFunction* fn, IrBlockId block, IrBlockId succ[2]) {
+    const IrBlock* b = &fn->blocks[block];
+    if (b->count == 0) return 0;
+    const IrInst* last = &fn->insts[b->insts[b->count - 1]];
+    switch (last->op) {
+        case IR_JUMP:
+            succ[0] = last->target[0];
+            return 1;
+        case IR_BRANCH:
+            succ[0] = last->target[0];
+            succ[1] = last->target[1];
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+IrValue ir_resolve(const IrFunction* fn, IrValue v) {
+    while (v != IR_NONE && fn->insts[v].op == IR_COPY) {
+        v = fn->insts[v].a;
+    }
+    return v;
+}
+
+// Undefined values go first in the entry block, which may be finished already
+IrValue ir_emit_undef(IrFunction* fn, DataType type) {
+    IrInst inst;
+    memset(&inst, 0, sizeof(IrInst));
+    inst.op = IR_UNDEF;
+    inst.type = type;
+    inst.a = inst.b = IR_NONE;
+    inst.var = VAR_NONE;
+    IrValue v = ir_emit(fn, 0, inst);
+    IrBlock* entry = &fn->blocks[0];
+    memmove(entry->insts + 1, entry->insts, sizeof(IrValue) * (entry->count - 1));
+    entry->insts[0] = v;
+    return v;
+}
+
+IrValue ir_remove_trivial_phi(IrFunction* fn, IrValue phi) {
+    const IrInst* inst = &fn->insts[phi];
+    IrValue same = IR_NONE;
+    for (uint32_t i = 0; i < inst->args.count; i++) {
+        IrValue op = ir_resolve(fn, fn->operands[inst->args.first + i]);
+        if (op == same || op == phi) continue;
+        // merges two values, not trivial
+        if (same != IR_NONE) return phi;
+        same = op;
+    }
+    // only reachable from itself, or not at all
+    if (same == IR_NONE) same = ir_emit_undef(fn, inst->type);
+    fn->insts[phi].op = IR_COPY;
+    fn->insts[phi].a = same;
+    return same;
+}
+
+// Phis can become trivial once the phis they use are replaced, drop those
+// too and point every operand at the value it stands for
+void ir_simplify_phis(IrFunction* fn) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (IrBlockId i = 0; i < fn->block_count; i++) {
+            const IrBlock* block = &fn->blocks[i];
+            for (uint32_t k = 0; k < block->phi_count; k++) {
+                IrValue phi = block->phis[k];
+                if (fn->insts[phi].op == IR_PHI && ir_remove_trivial_phi(fn, phi) != phi) changed = 1;
+            }
+        }
+    }
+    for (IrValue v = 0; v < fn->inst_count; v++) {
+        IrInst* inst = &fn->insts[v];
+        inst->a = ir_resolve(fn, inst->a);
+        inst->b = ir_resolve(fn, inst->b);
+        if (inst->op == IR_PHI || inst->op == IR_CALL) {
+            for (uint32_t k = 0; k < inst->args.count; k++) {
+                IrValue* operand = &fn->operands[inst->args.first + k];
+                *operand = ir_resolve(fn, *operand);
+            }
+        }
+    }
+    for (IrBlockId i = 0; i < fn->block_count; i++) {
+        IrBlock* block = &fn->blocks[i];
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < block->phi_count; k++) {
+            IrValue phi = block->phis[k];
+            if (fn->insts[phi].op == IR_PHI) block->phis[kept++] = phi;
+            else fn->insts[phi].block = IR_NONE;
+        }
+        block->phi_count = kept;
+    }
+}
+
+/*
+
+Dominators
+
+*/
+
+uint32_t ir_reverse_postorder(const IrFunction* fn, IrBlockId* order) {
+    const uint32_t count = fn->block_count;
+    unsigned char* seen = calloc(count ? count : 1, 1);
+    IrBlockId* stack = malloc(sizeof(IrBlockId) * (count ? count : 1));
+    unsigned char* next = malloc(count ? count : 1);   // Successor of the stacked block to visit next
+    if (!seen || !stack || !next) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    uint32_t top = 0;
+    uint32_t done = count;
+    if (count > 0) {
+        seen[0] = 1;
+        next[0] = 0;
+        stack[top++] = 0;
+    }
+    while (top > 0) {
+        const IrBlockId block = stack[top - 1];
+        IrBlockId succ[2];
+        const int n = ir_successors(fn, block, succ);
+        if (next[block] < n) {
+            const IrBlockId to = succ[next[block]++];
+            if (!seen[to]) {
+                seen[to] = 1;
+                next[to] = 0;
+                stack[top++] = to;
+            }
+        } else {
+            // postorder from the back is reverse postorder
+            order[--done] = block;
+            top--;
+        }
+    }
+    // move it to the front past the blocks never reached
+    const uint32_t reached = count - done;
+    memmove(order, order + done, sizeof(IrBlockId) * reached);
+    free(seen);
+    free(stack);
+    free(next);
+    return reached;
+}
+
+/* Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm": visit the
+ * blocks in reverse postorder and set each one's idom to the nearest common
+ * dominator of its processed preds until nothing changes. Two blocks meet by
+ * walking up from the one later in the order.
+ */
+void ir_dominators(const IrFunction* fn, IrBlockId* idom) {
+    const uint32_t count = fn->block_count;
+    IrBlockId* order = malloc(sizeof(IrBlockId) * (count ? count : 1));
+    uint32_t* position = malloc(sizeof(uint32_t) * (count ? count : 1));
+    if (!order || !position) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    const uint32_t reached = ir_reverse_postorder(fn, order);
+    for (IrBlockId b = 0; b < count; b++) {
+        idom[b] = IR_NONE;
+    }
+    for (uint32_t i = 0; i < reached; i++) {
+        position[order[i]] = i;
+    }
+    if (reached > 0) idom[order[0]] = order[0];
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 1; i < reached; i++) {
+            const IrBlockId block = order[i];
+            const IrBlock* b = &fn->blocks[block];
+            IrBlockId dom = IR_NONE;
+            for (uint32_t k = 0; k < b->pred_count; k++) {
+                IrBlockId pred = b->preds[k];
+                if (idom[pred] == IR_NONE) continue;
+                if (dom == IR_NONE) {
+                    dom = pred;
+                    continue;
+                }
+                while (pred != dom) {
+                    while (position[pred] > position[dom]) pred = idom[pred];
+                    while (position[dom] > position[pred]) dom = idom[dom];
+                }
+            }
+            if (idom[block] != dom) {
+                idom[block] = dom;
+                changed = 1;
+            }
+        }
+    }
+    free(order);
+    free(position);
+}
+
+int ir_dominates(const IrBlockId* idom, IrBlockId a, IrBlockId b) {
+    for (;;) {
+        if (a == b) return 1;
+        if (idom[b] == IR_NONE || idom[b] == b) return 0;
+        b = idom[b];
+    }
+}
+
+static void free_function(IrFunction* fn) {
+    for (uint32_t i = 0; i < fn->block_count; i++) {
+        free(fn->blocks[i].phis);
+        free(fn->blocks[i].insts);
+        free(fn->blocks[i].preds);
+    }
+    free(fn->blocks);
+    free(fn->insts);
+    free(fn->operands);
+}
+
+void ir_free(IrProgram* program) {
+    for (uint32_t i = 0; i < program->function_count; i++) {
+        free_function(&program->functions[i]);
+    }
+    free(program->functions);
+    free(program->variables);
+    free(program->in_memory);
+    memset(program, 0, sizeof(IrProgram));
+}
+
+/*
+
+Printing
+
+*/
+
+static const char* type_name(DataType type) {
+    switch (type) {
+        case TYPE_INT: return "int";
+        case TYPE_UINT: return "uint";
+        case TYPE_FLOAT: return "float";
+        case TYPE_STRING: return "string";
+        case TYPE_CHAR: return "char";
+        default: return "?";
+    }
+}
+
+static const char* var_name(const IrProgram* program, int var) {
+    return var >= 0 && var < program->variable_count ? intern_text(program->variables[var].name) : "?";
+}
+
+static void print_inst(const IrProgram* program, const IrFunction* fn, IrValue v) {
+    const IrInst* inst = &fn->insts[v];
+    const char* type = type_name(inst->type);
+    switch (inst->op) {
+        case IR_CONST:
+            if (inst->type == TYPE_STRING) printf("  v%u = string \"%s\"\n", v, intern_text(inst->string));
+            else if (inst->type == TYPE_FLOAT) printf("  v%u = float %g\n", v, inst->value.f);
+            else printf("  v%u = %s %lld\n", v, type, (long long)inst->value.u);
+            break;
+        case IR_UNDEF:
+            printf("  v%u = %s undef\n", v, type);
+            break;
+        case IR_PARAM:
+            printf("  v%u = %s param %u\n", v, type, inst->index);
+            break;
+        case IR_PHI:
+            printf("  v%u = %s phi %s", v, type, var_name(program, inst->var));
+            for (uint32_t i = 0; i < inst->args.count; i++) {
+                printf(" [b%u v%u]", fn->blocks[inst->block].preds[i], fn->operands[inst->args.first + i]);
+            }
+            printf("\n");
+            break;
+        case IR_COPY:
+            printf("  v%u = %s v%u\n", v, type, inst->a);
+            break;
+        case IR_BINARY:
+            printf("  v%u = %s v%u %s v%u\n", v, type, inst->a, kind_to_string(inst->kind), inst->b);
+            break;
+        case IR_UNARY:
+            printf("  v%u = %s %sv%u\n", v, type, kind_to_string(inst->kind), inst->a);
+            break;
+        case IR_CONVERT:
+            printf("  v%u = %s convert v%u\n", v, type, inst->a);
+            break;
+        case IR_FACTORIAL:
+            printf("  v%u = %s factorial v%u\n", v, type, inst->a);
+            break;
+        case IR_LOAD:
+            printf("  v%u = %s load %s\n", v, type, var_name(program, inst->var));
+            break;
+        case IR_STORE:
+            printf("  store %s v%u\n", var_name(program, inst->var), inst->a);
+            break;
+        case IR_CALL:
+            printf("  v%u = %s call %s(", v, type, var_name(program, inst->var));
+            for (uint32_t i = 0; i < inst->args.count; i++) {
+                printf(i ? ", v%u" : "v%u", fn->operands[inst->args.first + i]);
+            }
+            printf(")\n");
+            break;
+        case IR_PRINT:
+            printf("  print v%u\n", inst->a);
+            break;
+        case IR_JUMP:
+            printf("  jump b%u\n", inst->target[0]);
+            break;
+        case IR_BRANCH:
+            printf("  branch v%u b%u b%u\n", inst->a, inst->target[0], inst->target[1]);
+            break;
+        case IR_RETURN:
+            printf("  return\n");
+            break;
+    }
+}
+
+void ir_print(const IrProgram* program) {
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        const IrFunction* fn = &program->functions[f];
+        if (fn->var == VAR_NONE) printf("function (top level):\n");
+        else printf("function %s %s:\n", type_name(fn->type), intern_text(fn->name));
+        for (IrBlockId b = 0; b < fn->block_count; b++) {
+            const IrBlock* block = &fn->blocks[b];
+            printf("b%u:", b);
+            for (uint32_t i = 0; i < block->pred_count; i++) {
+                printf(i ? " b%u" : " preds b%u", block->preds[i]);
+            }
+            printf("\n");
+            for (uint32_t i = 0; i < block->phi_count; i++) {
+                print_inst(program, fn, block->phis[i]);
+            }
+            for (uint32_t i = 0; i < block->count; i++) {
+                print_inst(program, fn, block->insts[i]);
+            }
+        }
+        printf("\n");
+    }
+}
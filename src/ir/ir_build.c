@@ -0,0 +1,756 @@
+#include "ir.h"
+#include "fold.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Lowering to SSA
+ * SSA form is built while lowering, after Braun et al., "Simple and Efficient
+ * Construction of Static Single Assignment Form" (CC 2013). Every block maps
+ * the variables it writes to their current value. Reading a variable a block
+ * doesn't know asks its predecessors, through a phi where several meet. A
+ * block is sealed once all its predecessors are known; until then a read in
+ * it gets an incomplete phi, whose operands are read when it is sealed. A
+ * loop header is sealed after its back edge. A phi whose operands are all
+ * the same value (or itself) is replaced by that value: it becomes an IR_COPY
+ * and is cleaned up once the function is done, see ir_simplify_phis().
+ * Reads walk up the predecessors with an explicit stack, so long chains of
+ * blocks don't recurse.
+ *
+ * The tree is lowered with one ast_walk per function. Expression values go on
+ * a stack, a node pops its operands' values and pushes its own. The branches
+ * of an if, while or repeat are emitted from the post callback of the child
+ * that comes before them. A folded node is lowered as the constant it holds,
+ * its children are skipped.
+ * Operands of && and || are both evaluated, like those of any other operator.
+ */
+
+// Current value of var in block, from an older epoch if empty
+typedef struct {
+    IrBlockId block;
+    int var;
+    uint32_t epoch;
+    IrValue value;
+} DefSlot;
+
+typedef struct {
+    IrBlockId block;
+    IrValue phi;
+} PendingPhi;
+
+// A block waiting on the value of the variable being read in its predecessors
+typedef struct {
+    IrBlockId block;
+    IrValue phi;                // IR_NONE for a block with one pred, it just records the value
+    uint32_t pred;              // Predecessor being read
+} ReadFrame;
+
+// An if, while or repeat being lowered
+typedef struct {
+    NodeId node;
+    IrBlockId header;           // while: the condition, repeat: the body
+    IrBlockId join;             // if: after it, while and repeat: the exit
+    IrBlockId other;            // if: the else block, join without one
+} ControlFrame;
+
+typedef struct {
+    IrProgram* program;
+    const FlatAST* ast;
+    IrFunction* fn;
+    NodeId root;                // Function being lowered
+    IrBlockId current;          // Block code is emitted to
+    uint32_t param_count;
+    IrValue* values;
+    uint32_t value_count;
+    uint32_t value_capacity;
+    DefSlot* defs;
+    uint32_t def_capacity;      // Power of two
+    uint32_t def_used;
+    uint32_t epoch;             // Bumped per function, empties defs
+    PendingPhi* incomplete;
+    uint32_t incomplete_count;
+    uint32_t incomplete_capacity;
+    ReadFrame* frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    ControlFrame* control;
+    uint32_t control_count;
+    uint32_t control_capacity;
+    NodeId* queue;              // Functions to lower, nested ones are found along the way
+    uint32_t queue_count;
+    uint32_t queue_capacity;
+} Builder;
+
+static IrInst make_inst(IrOp op, DataType type, int line) {
+    IrInst inst;
+    memset(&inst, 0, sizeof(IrInst));
+    inst.op = op;
+    inst.type = type;
+    inst.a = inst.b = IR_NONE;
+    inst.var = VAR_NONE;
+    inst.line = line;
+    return inst;
+}
+
+static IrValue emit(Builder* b, IrInst inst) {
+    return ir_emit(b->fn, b->current, inst);
+}
+
+static DataType value_type(const IrFunction* fn, IrValue v) {
+    return fn->insts[ir_resolve(fn, v)].type;
+}
+
+static void push_value(Builder* b, IrValue v) {
+    IR_PUSH(b->values, b->value_count, b->value_capacity, v);
+}
+
+static IrValue pop_value(Builder* b) {
+    return b->value_count > 0 ? b->values[--b->value_count] : IR_NONE;
+}
+
+/*
+
+Definitions and SSA construction
+
+*/
+
+static inline uint32_t def_hash(IrBlockId block, int var) {
+    return (block * 2654435761u) ^ ((uint32_t)var * 2246822519u);
+}
+
+static DefSlot* find_def(DefSlot* defs, uint32_t capacity, uint32_t epoch, IrBlockId block, int var) {
+    uint32_t i = def_hash(block, var) & (capacity - 1);
+    while (defs[i].epoch == epoch && (defs[i].block != block || defs[i].var != var)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &defs[i];
+}
+
+static IrValue lookup_def(const Builder* b, IrBlockId block, int var) {
+    if (b->def_capacity == 0) return IR_NONE;
+    DefSlot* slot = find_def(b->defs, b->def_capacity, b->epoch, block, var);
+    return slot->epoch == b->epoch ? slot->value : IR_NONE;
+}
+
+static void write_def(Builder* b, IrBlockId block, int var, IrValue value) {
+    // keep the table at most half full
+    if (b->def_used * 2 >= b->def_capacity) {
+        uint32_t capacity = b->def_capacity ? b->def_capacity * 2 : 256;
+        DefSlot* defs = calloc(capacity, sizeof(DefSlot));
+        if (!defs) {
+            fprintf(stderr, "No memory for the IR\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < b->def_capacity; i++) {
+            if (b->defs[i].epoch != b->epoch) continue;
+            const DefSlot* old = &b->defs[i];
+            *find_def(defs, capacity, b->epoch, old->block, old->var) = *old;
+        }
+        free(b->defs);
+        b->defs = defs;
+        b->def_capacity = capacity;
+    }
+    DefSlot* slot = find_def(b->defs, b->def_capacity, b->epoch, block, var);
+    if (slot->epoch != b->epoch) {
+        *slot = (DefSlot){ block, var, b->epoch, IR_NONE };
+        b->def_used++;
+    }
+    slot->value = value;
+}
+
+static IrValue new_phi(Builder* b, IrBlockId block, int var) {
+    return ir_emit_phi(b->fn, block, b->program->variables[var].type, var);
+}
+
+static void push_frame(Builder* b, IrBlockId block, IrValue phi) {
+    ReadFrame frame = { block, phi, 0 };
+    IR_PUSH(b->frames, b->frame_count, b->frame_capacity, frame);
+}
+
+// Value of var at the end of block
+static IrValue read_variable(Builder* b, int var, IrBlockId block) {
+    IrFunction* fn = b->fn;
+    b->frame_count = 0;
+    for (;;) {
+        // go up the preds until a block knows the value
+        IrValue value = lookup_def(b, block, var);
+        if (value != IR_NONE) {
+            value = ir_resolve(fn, value);
+        } else if (!fn->blocks[block].sealed) {
+            value = new_phi(b, block, var);
+            PendingPhi pending = { block, value };
+            IR_PUSH(b->incomplete, b->incomplete_count, b->incomplete_capacity, pending);
+            write_def(b, block, var, value);
+        } else if (fn->blocks[block].pred_count == 0) {
+            value = ir_emit_undef(fn, b->program->variables[var].type);
+            write_def(b, block, var, value);
+        } else if (fn->blocks[block].pred_count == 1) {
+            push_frame(b, block, IR_NONE);
+            block = fn->blocks[block].preds[0];
+            continue;
+        } else {
+            // the phi is the value while its operands are read, that ends loops
+            IrValue phi = new_phi(b, block, var);
+            fn->insts[phi].args.first = ir_add_operands(fn, fn->blocks[block].pred_count);
+            fn->insts[phi].args.count = fn->blocks[block].pred_count;
+            write_def(b, block, var, phi);
+            push_frame(b, block, phi);
+            block = fn->blocks[block].preds[0];
+            continue;
+        }
+
+        // hand the value down to the blocks waiting for it
+        for (;;) {
+            if (b->frame_count == 0) return value;
+            ReadFrame* frame = &b->frames[b->frame_count - 1];
+            if (frame->phi != IR_NONE) {
+                const IrBlock* phi_block = &fn->blocks[frame->block];
+                fn->operands[fn->insts[frame->phi].args.first + frame->pred++] = value;
+                if (frame->pred < phi_block->pred_count) {
+                    block = phi_block->preds[frame->pred];
+                    break;
+                }
+                value = ir_remove_trivial_phi(fn, frame->phi);
+            }
+            write_def(b, frame->block, var, value);
+            b->frame_count--;
+        }
+    }
+}
+
+static void add_phi_operands(Builder* b, IrValue phi) {
+    IrFunction* fn = b->fn;
+    const IrBlockId block = fn->insts[phi].block;
+    const int var = fn->insts[phi].var;
+    const uint32_t count = fn->blocks[block].pred_count;
+    const uint32_t first = ir_add_operands(fn, count);
+    fn->insts[phi].args.first = first;
+    fn->insts[phi].args.count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        IrValue value = read_variable(b, var, fn->blocks[block].preds[i]);
+        fn->operands[first + i] = value;
+    }
+    ir_remove_trivial_phi(fn, phi);
+}
+
+// All preds of block are known, fill in the phis it got meanwhile
+static void seal_block(Builder* b, IrBlockId block) {
+    b->fn->blocks[block].sealed = 1;
+    uint32_t i = 0;
+    while (i < b->incomplete_count) {
+        if (b->incomplete[i].block != block) {
+            i++;
+            continue;
+        }
+        IrValue phi = b->incomplete[i].phi;
+        b->incomplete[i] = b->incomplete[--b->incomplete_count];
+        // may add incomplete phis for other blocks
+        add_phi_operands(b, phi);
+    }
+}
+
+static int is_numeric(DataType type) {
+    return type == TYPE_INT || type == TYPE_UINT || type == TYPE_FLOAT || type == TYPE_CHAR;
+}
+
+// Only float to integer and back changes the representation
+static IrValue convert(Builder* b, IrValue v, DataType to, int line) {
+    const DataType from = value_type(b->fn, v);
+    if (!is_numeric(from) || !is_numeric(to) || (from == TYPE_FLOAT) == (to == TYPE_FLOAT)) return v;
+    IrInst inst = make_inst(IR_CONVERT, to, line);
+    inst.a = v;
+    return emit(b, inst);
+}
+
+static IrValue read_var(Builder* b, int var, int line) {
+    if (var == VAR_NONE) return ir_emit_undef(b->fn, TYPE_UNKNOWN);
+    if (b->program->in_memory[var]) {
+        IrInst inst = make_inst(IR_LOAD, b->program->variables[var].type, line);
+        inst.var = var;
+        return emit(b, inst);
+    }
+    return read_variable(b, var, b->current);
+}
+
+// Returns the value as stored, converted to the variable's type
+static IrValue write_var(Builder* b, int var, IrValue value, int line) {
+    if (var == VAR_NONE) return value;
+    value = convert(b, value, b->program->variables[var].type, line);
+    if (b->program->in_memory[var]) {
+        IrInst inst = make_inst(IR_STORE, b->program->variables[var].type, line);
+        inst.var = var;
+        inst.a = value;
+        emit(b, inst);
+    } else {
+        write_def(b, b->current, var, value);
+    }
+    return value;
+}
+
+/*
+
+Control flow
+
+*/
+
+static void jump(Builder* b, IrBlockId target) {
+    IrInst inst = make_inst(IR_JUMP, TYPE_UNKNOWN, 0);
+    inst.target[0] = target;
+    emit(b, inst);
+    ir_add_pred(b->fn, target, b->current);
+}
+
+static void branch(Builder* b, IrValue cond, IrBlockId then, IrBlockId other, int line) {
+    IrInst inst = make_inst(IR_BRANCH, TYPE_UNKNOWN, line);
+    inst.a = cond;
+    inst.target[0] = then;
+    inst.target[1] = other;
+    emit(b, inst);
+    ir_add_pred(b->fn, then, b->current);
+    ir_add_pred(b->fn, other, b->current);
+}
+
+static void push_control(Builder* b, NodeId node, IrBlockId header) {
+    ControlFrame frame = { node, header, IR_NONE, IR_NONE };
+    IR_PUSH(b->control, b->control_count, b->control_capacity, frame);
+}
+
+// Emits the control flow that follows child of an if, while or repeat
+static void after_child(Builder* b, const WalkFrame* child) {
+    const NodeId parent = child->parent;
+    if (b->control_count == 0 || b->control[b->control_count - 1].node != parent) return;
+    ControlFrame* control = &b->control[b->control_count - 1];
+    IrFunction* fn = b->fn;
+    const int line = flat_line(b->ast, parent);
+
+    switch (flat_type(b->ast, parent)) {
+        case AST_IF:
+            if (child->slot == AST_SLOT_LEFT) {
+                IrValue cond = pop_value(b);
+                IrBlockId then = ir_new_block(fn);
+                control->join = ir_new_block(fn);
+                control->other = flat_body(b->ast, parent) != NODE_NONE ? ir_new_block(fn) : control->join;
+                branch(b, cond, then, control->other, line);
+                seal_block(b, then);
+                if (control->other != control->join) seal_block(b, control->other);
+                b->current = then;
+            } else if (child->slot == AST_SLOT_RIGHT) {
+                jump(b, control->join);
+                b->current = control->other;
+            } else if (child->slot == AST_SLOT_BODY) {
+                jump(b, control->join);
+                b->current = control->join;
+            }
+            break;
+        case AST_WHILE:
+            if (child->slot == AST_SLOT_LEFT) {
+                IrValue cond = pop_value(b);
+                IrBlockId body = ir_new_block(fn);
+                control->join = ir_new_block(fn);
+                branch(b, cond, body, control->join, line);
+                seal_block(b, body);
+                b->current = body;
+            } else if (child->slot == AST_SLOT_RIGHT) {
+                jump(b, control->header);
+            }
+            break;
+        case AST_REPEAT:
+            // until the condition holds
+            if (child->slot == AST_SLOT_RIGHT) {
+                IrValue cond = pop_value(b);
+                control->join = ir_new_block(fn);
+                branch(b, cond, control->join, control->header, line);
+                seal_block(b, control->header);
+                seal_block(b, control->join);
+                b->current = control->join;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+
+Lowering
+
+*/
+
+static int is_expression(ASTType type) {
+    switch (type) {
+        case AST_BINOP:
+        case AST_UNARYOP:
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+        case AST_FUNCTION_CALL:
+        case AST_ASSIGN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Whether the parent takes the value of an expression child off the stack
+static int value_used(const FlatAST* ast, const WalkFrame* frame) {
+    if (frame->parent == NODE_NONE) return 0;
+    switch (flat_type(ast, frame->parent)) {
+        case AST_BINOP:
+        case AST_UNARYOP:
+        case AST_ASSIGN:
+        case AST_FUNCTION_CALL:
+            return 1;
+        case AST_IF:
+        case AST_WHILE:
+            return frame->slot == AST_SLOT_LEFT;
+        case AST_REPEAT:
+        case AST_PRINT:
+            return frame->slot == AST_SLOT_RIGHT;
+        default:
+            return 0;
+    }
+}
+
+static IrValue constant(Builder* b, DataType type, TokenValue value, int line) {
+    IrInst inst = make_inst(IR_CONST, type, line);
+    inst.value = value;
+    return emit(b, inst);
+}
+
+static IrValue lower_literal(Builder* b, NodeId node) {
+    const FlatAST* ast = b->ast;
+    const int line = flat_line(ast, node);
+    // folding only makes numbers
+    if (!ast->folded[node] && FLAT_TOKEN_TYPE(ast->info[node]) == TOKEN_STRING) {
+        IrInst inst = make_inst(IR_CONST, TYPE_STRING, line);
+        inst.string = ast->aux[node];
+        return emit(b, inst);
+    }
+    return constant(b, ast->data_type[node], ast->value[node], line);
+}
+
+// Value of a variable declared without one
+static IrValue zero(Builder* b, DataType type, int line) {
+    TokenValue value;
+    memset(&value, 0, sizeof(TokenValue));
+    return constant(b, type, value, line);
+}
+
+static IrValue lower_binary(Builder* b, TokenKind op, IrValue left, IrValue right, DataType type, int line) {
+    const DataType left_type = value_type(b->fn, left);
+    const DataType right_type = value_type(b->fn, right);
+    // mixed integer and float operands are computed in float
+    if (is_numeric(left_type) && is_numeric(right_type) && (left_type == TYPE_FLOAT) != (right_type == TYPE_FLOAT)) {
+        left = convert(b, left, TYPE_FLOAT, line);
+        right = convert(b, right, TYPE_FLOAT, line);
+    }
+    IrInst inst = make_inst(IR_BINARY, type, line);
+    inst.kind = op;
+    inst.a = left;
+    inst.b = right;
+    return emit(b, inst);
+}
+
+static IrValue lower_unary(Builder* b, NodeId node, IrValue operand) {
+    const FlatAST* ast = b->ast;
+    const TokenKind op = flat_kind(ast, node);
+    const int line = flat_line(ast, node);
+    if (op == OP_ADD) return operand;
+    if (op == OP_INC || op == OP_DEC) {
+        const DataType type = value_type(b->fn, operand);
+        TokenValue one;
+        if (type == TYPE_FLOAT) one.f = 1;
+        else one.u = 1;
+        IrValue result = lower_binary(b, op == OP_INC ? OP_ADD : OP_SUB, operand, constant(b, type, one, line), type, line);
+        const NodeId target = flat_right(ast, node);
+        if (target != NODE_NONE && folded_type(ast, target) == AST_IDENTIFIER) {
+            result = write_var(b, ast->var_index[target], result, line);
+        }
+        return result;
+    }
+    IrInst inst = make_inst(IR_UNARY, ast->data_type[node], line);
+    inst.kind = op;
+    inst.a = operand;
+    return emit(b, inst);
+}
+
+static IrValue lower_call(Builder* b, NodeId node) {
+    const FlatAST* ast = b->ast;
+    uint32_t count = 0;
+    for (NodeId arg = flat_body(ast, node); arg != NODE_NONE; arg = flat_next(ast, arg)) count++;
+    if (count > b->value_count) count = b->value_count;
+    b->value_count -= count;
+    const IrValue* args = b->values + b->value_count;
+
+    // the checker only lets factorial through unresolved
+    if (ast->var_index[node] == VAR_NONE) {
+        IrInst inst = make_inst(IR_FACTORIAL, ast->data_type[node], flat_line(ast, node));
+        inst.a = count ? args[0] : IR_NONE;
+        return emit(b, inst);
+    }
+    IrInst inst = make_inst(IR_CALL, ast->data_type[node], flat_line(ast, node));
+    inst.var = ast->var_index[node];
+    inst.args.first = ir_add_operands(b->fn, count);
+    inst.args.count = count;
+    if (count) memcpy(b->fn->operands + inst.args.first, args, sizeof(IrValue) * count);
+    return emit(b, inst);
+}
+
+_Static_assert(OP_XOR_ASSIGN - OP_ADD_ASSIGN == OP_XOR - OP_ADD, "compound assignments no longer line up with their operators");
+
+static IrValue lower_assign(Builder* b, NodeId node) {
+    const FlatAST* ast = b->ast;
+    IrValue value = pop_value(b);
+    const NodeId target = flat_left(ast, node);
+    // the checker only lets variables be assigned to
+    assert(target != NODE_NONE && (folded_type(ast, target) == AST_IDENTIFIER || folded_type(ast, target) == AST_VARDECL) &&
+           ast->var_index[target] != VAR_NONE);
+    const TokenKind kind = flat_kind(ast, node);
+    const int line = flat_line(ast, node);
+    // x op= e is x = x op e, x was read on the way. A declaration has no old value
+    if (kind != OP_ASSIGN && flat_type(ast, target) == AST_IDENTIFIER) {
+        const TokenKind op = OP_ADD + (kind - OP_ADD_ASSIGN);
+        IrValue old = pop_value(b);
+        DataType type = get_result_type(ast->data_type[target], value_type(b->fn, value), op);
+        value = lower_binary(b, op, old, value, type, line);
+    }
+    return write_var(b, ast->var_index[target], value, line);
+}
+
+static void lower_declaration(Builder* b, const WalkFrame* frame) {
+    const FlatAST* ast = b->ast;
+    const NodeId decl = flat_body(ast, frame->node);
+    // initialized by an assignment or a function, both lowered on their own
+    if (decl == NODE_NONE || flat_type(ast, decl) != AST_VARDECL || flat_body(ast, decl) != NODE_NONE ||
+        ast->var_index[decl] == VAR_NONE) return;
+    const int line = flat_line(ast, decl);
+    const int var = ast->var_index[decl];
+    const DataType type = b->program->variables[var].type;
+    if (frame->parent == b->root && flat_type(ast, b->root) == AST_VARDECL) {
+        IrInst inst = make_inst(IR_PARAM, type, line);
+        inst.index = b->param_count++;
+        write_var(b, var, emit(b, inst), line);
+    } else {
+        write_var(b, var, zero(b, type, line), line);
+    }
+}
+
+static WalkAction lower_enter(const WalkFrame* frame, void* ctx) {
+    Builder* b = ctx;
+    const NodeId node = frame->node;
+    // a folded node is a constant, lowered on the way up
+    if (b->ast->folded[node]) return WALK_SKIP;
+    switch (flat_type(b->ast, node)) {
+        case AST_VARDECL:
+            // a function inside the one being lowered gets lowered on its own
+            if (flat_body(b->ast, node) != NODE_NONE && frame->slot != AST_SLOT_ROOT) {
+                IR_PUSH(b->queue, b->queue_count, b->queue_capacity, node);
+                return WALK_SKIP;
+            }
+            break;
+        case AST_IF:
+            push_control(b, node, IR_NONE);
+            break;
+        case AST_WHILE:
+        case AST_REPEAT: {
+            // the condition of a while and the body of a repeat start over on every iteration
+            IrBlockId header = ir_new_block(b->fn);
+            jump(b, header);
+            b->current = header;
+            push_control(b, node, header);
+            break;
+        }
+        default:
+            break;
+    }
+    return WALK_CONTINUE;
+}
+
+static void lower_leave(const WalkFrame* frame, void* ctx) {
+    Builder* b = ctx;
+    const FlatAST* ast = b->ast;
+    const NodeId node = frame->node;
+    const ASTType type = folded_type(ast, node);
+    const int line = flat_line(ast, node);
+    switch (type) {
+        case AST_LITERAL:
+            push_value(b, lower_literal(b, node));
+            break;
+        case AST_IDENTIFIER: {
+            const NodeId parent = frame->parent;
+            // the target of a plain assignment is only written
+            if (parent != NODE_NONE && flat_type(ast, parent) == AST_ASSIGN && frame->slot == AST_SLOT_LEFT &&
+                flat_kind(ast, parent) == OP_ASSIGN) break;
+            push_value(b, read_var(b, ast->var_index[node], line));
+            break;
+        }
+        case AST_BINOP: {
+            IrValue right = pop_value(b);
+            IrValue left = pop_value(b);
+            push_value(b, lower_binary(b, flat_kind(ast, node), left, right, ast->data_type[node], line));
+            break;
+        }
+        case AST_UNARYOP:
+            push_value(b, lower_unary(b, node, pop_value(b)));
+            break;
+        case AST_FUNCTION_CALL:
+            push_value(b, lower_call(b, node));
+            break;
+        case AST_ASSIGN:
+            push_value(b, lower_assign(b, node));
+            break;
+        case AST_VARDECLTYPE:
+            lower_declaration(b, frame);
+            break;
+        case AST_PRINT:
+            if (flat_right(ast, node) != NODE_NONE) {
+                IrInst inst = make_inst(IR_PRINT, TYPE_UNKNOWN, line);
+                inst.a = pop_value(b);
+                emit(b, inst);
+            }
+            break;
+        case AST_IF: {
+            ControlFrame control = b->control[--b->control_count];
+            if (control.join != IR_NONE) {
+                if (b->current != control.join) {
+                    jump(b, control.join);
+                    b->current = control.join;
+                }
+                seal_block(b, control.join);
+            }
+            break;
+        }
+        case AST_WHILE: {
+            ControlFrame control = b->control[--b->control_count];
+            seal_block(b, control.header);
+            if (control.join != IR_NONE) {
+                seal_block(b, control.join);
+                b->current = control.join;
+            }
+            break;
+        }
+        case AST_REPEAT:
+            b->control_count--;
+            break;
+        default:
+            break;
+    }
+    if (frame->parent != NODE_NONE) after_child(b, frame);
+    if (is_expression(type) && !value_used(ast, frame)) pop_value(b);
+}
+
+static const ASTVisitor lowering = { lower_enter, lower_leave };
+
+static void lower_function(Builder* b, NodeId root) {
+    IrProgram* program = b->program;
+    IrFunction fn;
+    memset(&fn, 0, sizeof(IrFunction));
+    fn.var = VAR_NONE;
+    fn.type = TYPE_UNKNOWN;
+    if (flat_type(b->ast, root) == AST_VARDECL) {
+        fn.name = b->ast->aux[root];
+        fn.var = b->ast->var_index[root];
+        if (fn.var != VAR_NONE) fn.type = program->variables[fn.var].type;
+    }
+    IR_PUSH(program->functions, program->function_count, program->function_capacity, fn);
+
+    b->fn = &program->functions[program->function_count - 1];
+    b->root = root;
+    b->param_count = 0;
+    b->value_count = 0;
+    b->incomplete_count = 0;
+    b->control_count = 0;
+    b->def_used = 0;
+    if (++b->epoch == 0) {
+        // wrapped around, stale definitions could look current again
+        memset(b->defs, 0, sizeof(DefSlot) * b->def_capacity);
+        b->epoch = 1;
+    }
+
+    b->current = ir_new_block(b->fn);
+    seal_block(b, b->current);
+    if (ast_walk(b->ast, root, &lowering, b) < 0) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    emit(b, make_inst(IR_RETURN, TYPE_UNKNOWN, 0));
+    b->fn->param_count = b->param_count;
+    ir_simplify_phis(b->fn);
+}
+
+/* A variable lives in memory if it is used from a function other than the
+ * one declaring it. Declarations come before their uses in the walk, so the
+ * owner of a variable is known by the time it is used.
+ */
+typedef struct {
+    const FlatAST* ast;
+    unsigned char* in_memory;
+    NodeId* owner;              // Per variable, the function declaring it, NODE_NONE for the top level
+    NodeId* functions;          // Functions the walk is in
+    uint32_t function_count;
+    uint32_t function_capacity;
+} MemoryScan;
+
+static WalkAction scan_enter(const WalkFrame* frame, void* ctx) {
+    MemoryScan* scan = ctx;
+    const FlatAST* ast = scan->ast;
+    const NodeId node = frame->node;
+    const NodeId function = scan->function_count ? scan->functions[scan->function_count - 1] : NODE_NONE;
+    const int var = ast->var_index[node];
+    // the variables a folded node read are not read any more
+    if (ast->folded[node]) return WALK_SKIP;
+    if (flat_type(ast, node) == AST_VARDECL) {
+        if (var != VAR_NONE) scan->owner[var] = function;
+        if (flat_body(ast, node) != NODE_NONE) IR_PUSH(scan->functions, scan->function_count, scan->function_capacity, node);
+    } else if (flat_type(ast, node) == AST_IDENTIFIER && var != VAR_NONE) {
+        if (scan->owner[var] != function) scan->in_memory[var] = 1;
+    }
+    return WALK_CONTINUE;
+}
+
+static void scan_leave(const WalkFrame* frame, void* ctx) {
+    MemoryScan* scan = ctx;
+    if (flat_type(scan->ast, frame->node) == AST_VARDECL && flat_body(scan->ast, frame->node) != NODE_NONE) scan->function_count--;
+}
+
+int ir_build(IrProgram* program, const FlatAST* ast, const SymbolTable* table) {
+    memset(program, 0, sizeof(IrProgram));
+    if (ast->count == 0) return 0;
+    const int count = table->variable_count;
+    program->variable_count = count;
+    program->variables = malloc(sizeof(Variable) * (count + 1));
+    program->in_memory = calloc(count + 1, 1);
+    MemoryScan scan = { ast, program->in_memory, malloc(sizeof(NodeId) * (count + 1)), NULL, 0, 0 };
+    if (!program->variables || !program->in_memory || !scan.owner) {
+        free(scan.owner);
+        ir_free(program);
+        return -1;
+    }
+    if (count) memcpy(program->variables, table->variables, sizeof(Variable) * count);
+    for (int i = 0; i < count; i++) scan.owner[i] = NODE_NONE;
+
+    static const ASTVisitor scanner = { scan_enter, scan_leave };
+    int walked = ast_walk(ast, 0, &scanner, &scan);
+    free(scan.owner);
+    free(scan.functions);
+    if (walked < 0) {
+        ir_free(program);
+        return -1;
+    }
+
+    Builder builder;
+    memset(&builder, 0, sizeof(Builder));
+    builder.program = program;
+    builder.ast = ast;
+    const NodeId root = 0;
+    IR_PUSH(builder.queue, builder.queue_count, builder.queue_capacity, root);
+    for (uint32_t i = 0; i < builder.queue_count; i++) {
+        lower_function(&builder, builder.queue[i]);
+    }
+    free(builder.values);
+    free(builder.defs);
+    free(builder.incomplete);
+    free(builder.frames);
+    free(builder.control);
+    free(builder.queue);
+    return 0;
+}
@@ -0,0 +1,368 @@
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Dead code elimination
+ * Runs on each function once it is built, in this order:
+ * - A branch on a constant becomes a jump, the edge not taken goes away.
+ * - Blocks the entry no longer reaches are dropped and the others
+ *   renumbered. Phis lose the operands of the dropped edges, those left
+ *   with a single value are replaced by it.
+ * - A block only entered by a jump from its single predecessor is appended
+ *   to it.
+ * - A store to a memory variable is dropped if the variable is dead after
+ *   it, that is no path reads it before it is stored again. It is read by a
+ *   load, by any call (the callee may load it) and at the end of a function
+ *   other than the top level code (its caller may). Liveness is solved
+ *   backwards over the blocks with one bit per variable the function stores.
+ * - Last, instructions without side effects whose value is never used are
+ *   dropped. Whatever the stores, calls, prints and terminators use is
+ *   marked, transitively, and the rest goes.
+ * Removed instructions stay in insts with block set to IR_NONE.
+ */
+
+// Above this many bit words per liveness set array, dead stores are kept
+#define MAX_LIVENESS_WORDS (1u << 22)
+
+static void* zalloc(size_t count, size_t size) {
+    void* array = calloc(count ? count : 1, size);
+    if (!array) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    return array;
+}
+
+// Drops the edge and the matching operand of every phi in to
+static void remove_edge(IrFunction* fn, IrBlockId from, IrBlockId to) {
+    IrBlock* block = &fn->blocks[to];
+    uint32_t i = 0;
+    while (i < block->pred_count && block->preds[i] != from) i++;
+    if (i == block->pred_count) return;
+    memmove(block->preds + i, block->preds + i + 1, sizeof(IrBlockId) * (block->pred_count - i - 1));
+    block->pred_count--;
+    for (uint32_t k = 0; k < block->phi_count; k++) {
+        IrInst* phi = &fn->insts[block->phis[k]];
+        IrValue* args = fn->operands + phi->args.first;
+        memmove(args + i, args + i + 1, sizeof(IrValue) * (phi->args.count - i - 1));
+        phi->args.count--;
+    }
+}
+
+static void fold_branches(IrFunction* fn) {
+    for (IrBlockId b = 0; b < fn->block_count; b++) {
+        const IrBlock* block = &fn->blocks[b];
+        if (block->count == 0) continue;
+        IrInst* last = &fn->insts[block->insts[block->count - 1]];
+        if (last->op != IR_BRANCH) continue;
+        const IrInst* cond = &fn->insts[last->a];
+        if (cond->op != IR_CONST || cond->type == TYPE_STRING) continue;
+        const int taken = cond->type == TYPE_FLOAT ? cond->value.f != 0 : cond->value.u != 0;
+        const IrBlockId dropped = last->target[taken ? 1 : 0];
+        last->op = IR_JUMP;
+        last->a = IR_NONE;
+        last->target[0] = last->target[taken ? 0 : 1];
+        remove_edge(fn, b, dropped);
+    }
+}
+
+static void drop_block(IrFunction* fn, IrBlock* block) {
+    for (uint32_t k = 0; k < block->phi_count; k++) {
+        fn->insts[block->phis[k]].block = IR_NONE;
+    }
+    for (uint32_t k = 0; k < block->count; k++) {
+        fn->insts[block->insts[k]].block = IR_NONE;
+    }
+    free(block->phis);
+    free(block->insts);
+    free(block->preds);
+}
+
+static void remove_unreachable(IrFunction* fn) {
+    const uint32_t count = fn->block_count;
+    unsigned char* reached = zalloc(count, 1);
+    IrBlockId* stack = zalloc(count, sizeof(IrBlockId));
+    uint32_t top = 0;
+    reached[0] = 1;
+    stack[top++] = 0;
+    while (top > 0) {
+        IrBlockId succ[2];
+        const int n = ir_successors(fn, stack[--top], succ);
+        for (int i = 0; i < n; i++) {
+            if (reached[succ[i]]) continue;
+            reached[succ[i]] = 1;
+            stack[top++] = succ[i];
+        }
+    }
+
+    // blocks keep their order, so a block only ever moves down
+    IrBlockId* renumber = stack;
+    IrBlockId kept = 0;
+    for (IrBlockId b = 0; b < count; b++) {
+        renumber[b] = reached[b] ? kept++ : IR_NONE;
+        if (reached[b]) continue;
+        IrBlockId succ[2];
+        const int n = ir_successors(fn, b, succ);
+        for (int i = 0; i < n; i++) {
+            if (reached[succ[i]]) remove_edge(fn, b, succ[i]);
+        }
+    }
+    if (kept < count) {
+        for (IrBlockId b = 0; b < count; b++) {
+            IrBlock* block = &fn->blocks[b];
+            if (!reached[b]) {
+                drop_block(fn, block);
+                continue;
+            }
+            for (uint32_t k = 0; k < block->pred_count; k++) {
+                block->preds[k] = renumber[block->preds[k]];
+            }
+            for (uint32_t k = 0; k < block->phi_count; k++) {
+                fn->insts[block->phis[k]].block = renumber[b];
+            }
+            for (uint32_t k = 0; k < block->count; k++) {
+                fn->insts[block->insts[k]].block = renumber[b];
+            }
+            if (block->count > 0) {
+                IrInst* last = &fn->insts[block->insts[block->count - 1]];
+                if (last->op == IR_JUMP || last->op == IR_BRANCH) last->target[0] = renumber[last->target[0]];
+                if (last->op == IR_BRANCH) last->target[1] = renumber[last->target[1]];
+            }
+            fn->blocks[renumber[b]] = *block;
+        }
+        fn->block_count = kept;
+    }
+    free(reached);
+    free(stack);
+}
+
+// Appends a block to its only predecessor when that one just jumps to it
+static void merge_blocks(IrFunction* fn) {
+    for (IrBlockId b = 0; b < fn->block_count; b++) {
+        IrBlock* block = &fn->blocks[b];
+        while (block->count > 0) {
+            const IrValue jump = block->insts[block->count - 1];
+            if (fn->insts[jump].op != IR_JUMP) break;
+            const IrBlockId target = fn->insts[jump].target[0];
+            IrBlock* next = &fn->blocks[target];
+            if (target == b || target == 0 || next->pred_count != 1 || next->phi_count != 0) break;
+            fn->insts[jump].block = IR_NONE;
+            block->count--;
+            for (uint32_t k = 0; k < next->count; k++) {
+                fn->insts[next->insts[k]].block = b;
+                IR_PUSH(block->insts, block->count, block->capacity, next->insts[k]);
+            }
+            // left empty, remove_unreachable() drops it
+            next->count = 0;
+            next->pred_count = 0;
+            IrBlockId succ[2];
+            const int n = ir_successors(fn, b, succ);
+            for (int i = 0; i < n; i++) {
+                IrBlock* after = &fn->blocks[succ[i]];
+                for (uint32_t k = 0; k < after->pred_count; k++) {
+                    if (after->preds[k] == target) after->preds[k] = b;
+                }
+            }
+        }
+    }
+}
+
+/*
+
+Dead stores
+
+*/
+
+typedef struct {
+    int* slot_of;               // Per variable, its bit, -1 if the function doesn't store it
+    int* stored;                // Variables with a bit
+    uint32_t count;
+    uint32_t words;             // Per set
+} StoreSlots;
+
+static inline int test_bit(const uint64_t* set, int slot) {
+    return (set[slot >> 6] >> (slot & 63)) & 1;
+}
+
+// Turns the set live after block into the one live before it, dropping the
+// stores nothing reads if remove is set
+static void transfer(IrFunction* fn, IrBlock* block, const StoreSlots* slots, uint64_t* live, int remove) {
+    for (uint32_t k = block->count; k-- > 0;) {
+        IrInst* inst = &fn->insts[block->insts[k]];
+        switch (inst->op) {
+            case IR_STORE: {
+                const int slot = slots->slot_of[inst->var];
+                if (remove && !test_bit(live, slot)) inst->block = IR_NONE;
+                live[slot >> 6] &= ~(1ull << (slot & 63));
+                break;
+            }
+            case IR_LOAD: {
+                const int slot = slots->slot_of[inst->var];
+                if (slot >= 0) live[slot >> 6] |= 1ull << (slot & 63);
+                break;
+            }
+            case IR_CALL:
+                memset(live, 0xff, sizeof(uint64_t) * slots->words);
+                break;
+            default:
+                break;
+        }
+    }
+    if (!remove) return;
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < block->count; k++) {
+        if (fn->insts[block->insts[k]].block != IR_NONE) block->insts[kept++] = block->insts[k];
+    }
+    block->count = kept;
+}
+
+static void live_out(const IrFunction* fn, IrBlockId block, const uint64_t* live_in, const uint64_t* at_exit,
+                     uint64_t* live, uint32_t words) {
+    IrBlockId succ[2];
+    const int n = ir_successors(fn, block, succ);
+    if (n == 0) memcpy(live, at_exit, sizeof(uint64_t) * words);
+    else memset(live, 0, sizeof(uint64_t) * words);
+    for (int i = 0; i < n; i++) {
+        const uint64_t* in = live_in + (size_t)succ[i] * words;
+        for (uint32_t w = 0; w < words; w++) live[w] |= in[w];
+    }
+}
+
+static void remove_dead_stores(IrFunction* fn, StoreSlots* slots) {
+    slots->count = 0;
+    for (IrBlockId b = 0; b < fn->block_count; b++) {
+        const IrBlock* block = &fn->blocks[b];
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IrInst* inst = &fn->insts[block->insts[k]];
+            if (inst->op != IR_STORE || slots->slot_of[inst->var] >= 0) continue;
+            slots->slot_of[inst->var] = (int)slots->count;
+            slots->stored[slots->count++] = inst->var;
+        }
+    }
+    if (slots->count == 0) return;
+    const uint32_t words = slots->words = (slots->count + 63) / 64;
+
+    if ((uint64_t)fn->block_count * words <= MAX_LIVENESS_WORDS) {
+        uint64_t* live_in = zalloc((size_t)fn->block_count * words, sizeof(uint64_t));
+        uint64_t* live = zalloc(words, sizeof(uint64_t));
+        // what a caller may still read, nothing after the top level code
+        uint64_t* at_exit = zalloc(words, sizeof(uint64_t));
+        if (fn->var != VAR_NONE) memset(at_exit, 0xff, sizeof(uint64_t) * words);
+
+        int changed = 1;
+        while (changed) {
+            changed = 0;
+            for (IrBlockId b = fn->block_count; b-- > 0;) {
+                live_out(fn, b, live_in, at_exit, live, words);
+                transfer(fn, &fn->blocks[b], slots, live, 0);
+                uint64_t* in = live_in + (size_t)b * words;
+                if (memcmp(in, live, sizeof(uint64_t) * words) != 0) {
+                    memcpy(in, live, sizeof(uint64_t) * words);
+                    changed = 1;
+                }
+            }
+        }
+        for (IrBlockId b = 0; b < fn->block_count; b++) {
+            live_out(fn, b, live_in, at_exit, live, words);
+            transfer(fn, &fn->blocks[b], slots, live, 1);
+        }
+        free(live_in);
+        free(live);
+        free(at_exit);
+    }
+    for (uint32_t i = 0; i < slots->count; i++) {
+        slots->slot_of[slots->stored[i]] = -1;
+    }
+}
+
+/*
+
+Unused values
+
+*/
+
+static int has_effect(IrOp op) {
+    switch (op) {
+        case IR_STORE:
+        case IR_CALL:
+        case IR_PRINT:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void mark(unsigned char* used, IrValue* work, uint32_t* count, IrValue v) {
+    if (v == IR_NONE || used[v]) return;
+    used[v] = 1;
+    work[(*count)++] = v;
+}
+
+static void remove_unused(IrFunction* fn) {
+    unsigned char* used = zalloc(fn->inst_count, 1);
+    // every value goes on the worklist at most once
+    IrValue* work = zalloc(fn->inst_count, sizeof(IrValue));
+    uint32_t count = 0;
+    for (IrBlockId b = 0; b < fn->block_count; b++) {
+        const IrBlock* block = &fn->blocks[b];
+        for (uint32_t k = 0; k < block->count; k++) {
+            if (has_effect(fn->insts[block->insts[k]].op)) mark(used, work, &count, block->insts[k]);
+        }
+    }
+    while (count > 0) {
+        const IrInst* inst = &fn->insts[work[--count]];
+        mark(used, work, &count, inst->a);
+        mark(used, work, &count, inst->b);
+        if (inst->op == IR_PHI || inst->op == IR_CALL) {
+            for (uint32_t k = 0; k < inst->args.count; k++) {
+                mark(used, work, &count, fn->operands[inst->args.first + k]);
+            }
+        }
+    }
+
+    for (IrBlockId b = 0; b < fn->block_count; b++) {
+        IrBlock* block = &fn->blocks[b];
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < block->phi_count; k++) {
+            const IrValue v = block->phis[k];
+            if (used[v]) block->phis[kept++] = v;
+            else fn->insts[v].block = IR_NONE;
+        }
+        block->phi_count = kept;
+        kept = 0;
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IrValue v = block->insts[k];
+            if (used[v]) block->insts[kept++] = v;
+            else fn->insts[v].block = IR_NONE;
+        }
+        block->count = kept;
+    }
+    free(used);
+    free(work);
+}
+
+void ir_eliminate_dead_code(IrProgram* program) {
+    StoreSlots slots;
+    memset(&slots, 0, sizeof(StoreSlots));
+    slots.slot_of = zalloc(program->variable_count, sizeof(int));
+    slots.stored = zalloc(program->variable_count, sizeof(int));
+    for (int i = 0; i < program->variable_count; i++) {
+        slots.slot_of[i] = -1;
+    }
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        IrFunction* fn = &program->functions[f];
+        fold_branches(fn);
+        remove_unreachable(fn);
+        ir_simplify_phis(fn);
+        merge_blocks(fn);
+        remove_unreachable(fn);
+        remove_dead_stores(fn, &slots);
+        remove_unused(fn);
+    }
+    free(slots.slot_of);
+    free(slots.stored);
+}
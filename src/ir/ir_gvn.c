@@ -0,0 +1,258 @@
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Global value numbering
+ * Dominator based: the blocks are visited down the dominator tree with a
+ * scoped hash table of the values computed so far. An instruction that
+ * computes the same thing as one already in the table (same op, type,
+ * operator, operands and constant) is replaced by it, every dominated use
+ * then reads the earlier value. What a block adds to the table is popped
+ * when its subtree is done, so only dominating values are ever reused.
+ * Operands of commutative operators are put in a fixed order first.
+ *
+ * Stores, calls and prints are never merged. Loads are, as long as memory
+ * didn't change in between: each load is keyed on a memory version that a
+ * store or a call bumps, and a store makes its value the one a load of the
+ * variable gets. A block starts with the version its idom ended with only if
+ * that is its single predecessor, a new one otherwise.
+ * Replaced instructions become copies, resolved and dropped at the end.
+ */
+
+typedef struct {
+    IrValue key;                // Instruction computing it, or a store standing for a load of its variable
+    IrValue value;
+    uint32_t memory;            // Version of memory a load read
+    uint32_t hash;
+    uint32_t next;              // Entry the bucket pointed to before, IR_NONE at the end
+} ValueEntry;
+
+typedef struct {
+    IrBlockId block;
+    IrBlockId child;            // Next child to visit, IR_NONE once done
+    uint32_t mark;              // entry_count before the block was numbered
+} DomFrame;
+
+typedef struct {
+    IrFunction* fn;
+    uint32_t* buckets;          // First entry of each chain
+    uint32_t bucket_mask;
+    ValueEntry* entries;        // A stack, popped per dominator subtree
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    uint32_t memory;            // Current memory version
+    uint32_t last_memory;
+} Numbering;
+
+static int is_commutative(TokenKind op) {
+    switch (op) {
+        case OP_ADD:
+        case OP_MUL:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_XOR:
+        case OP_EQ:
+        case OP_NE:
+        case OP_AND:
+        case OP_OR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int is_numbered(IrOp op) {
+    switch (op) {
+        case IR_CONST:
+        case IR_BINARY:
+        case IR_UNARY:
+        case IR_CONVERT:
+        case IR_FACTORIAL:
+        case IR_LOAD:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t payload(const IrInst* inst) {
+    if (inst->op != IR_CONST) return 0;
+    if (inst->type == TYPE_STRING) return inst->string;
+    return (uint32_t)(inst->value.u ^ (inst->value.u >> 32));
+}
+
+static uint32_t hash_inst(const IrInst* inst, uint32_t memory) {
+    uint32_t h = inst->op | (uint32_t)inst->type << 8 | (uint32_t)inst->kind << 16;
+    h = (h ^ inst->a) * 2654435761u;
+    h = (h ^ inst->b) * 2246822519u;
+    h = (h ^ (uint32_t)inst->var) * 3266489917u;
+    h = (h ^ payload(inst)) * 668265263u;
+    return h ^ memory ^ (h >> 15);
+}
+
+static int same_inst(const IrInst* x, const IrInst* y) {
+    if (x->op == IR_STORE) return y->op == IR_LOAD && x->var == y->var && x->type == y->type;
+    if (x->op != y->op || x->type != y->type || x->kind != y->kind) return 0;
+    if (x->a != y->a || x->b != y->b || x->var != y->var) return 0;
+    if (x->op != IR_CONST) return 1;
+    if (x->type == TYPE_STRING) return x->string == y->string;
+    // bit for bit, 0.0 and -0.0 are different constants
+    return x->value.u == y->value.u;
+}
+
+static uint32_t memory_of(const IrInst* inst, uint32_t memory) {
+    return inst->op == IR_LOAD ? memory : 0;
+}
+
+static IrValue find(const Numbering* n, const IrInst* inst, uint32_t memory) {
+    uint32_t e = n->buckets[hash_inst(inst, memory) & n->bucket_mask];
+    for (; e != IR_NONE; e = n->entries[e].next) {
+        const ValueEntry* entry = &n->entries[e];
+        if (entry->memory == memory && same_inst(&n->fn->insts[entry->key], inst)) return entry->value;
+    }
+    return IR_NONE;
+}
+
+// Records value as what key computes, hashed like inst
+static void insert(Numbering* n, const IrInst* inst, uint32_t memory, IrValue key, IrValue value) {
+    const uint32_t hash = hash_inst(inst, memory);
+    uint32_t* bucket = &n->buckets[hash & n->bucket_mask];
+    ValueEntry entry = { key, value, memory, hash, *bucket };
+    IR_PUSH(n->entries, n->entry_count, n->entry_capacity, entry);
+    *bucket = n->entry_count - 1;
+}
+
+// Back to the table as it was with mark entries
+static void pop_entries(Numbering* n, uint32_t mark) {
+    while (n->entry_count > mark) {
+        const ValueEntry* entry = &n->entries[--n->entry_count];
+        n->buckets[entry->hash & n->bucket_mask] = entry->next;
+    }
+}
+
+static void number_block(Numbering* n, IrBlockId block) {
+    IrFunction* fn = n->fn;
+    const IrBlock* b = &fn->blocks[block];
+    for (uint32_t k = 0; k < b->count; k++) {
+        const IrValue v = b->insts[k];
+        IrInst* inst = &fn->insts[v];
+        inst->a = ir_resolve(fn, inst->a);
+        inst->b = ir_resolve(fn, inst->b);
+        if (inst->op == IR_CALL) {
+            n->memory = ++n->last_memory;
+            continue;
+        }
+        if (inst->op == IR_STORE) {
+            // a load right after gets the stored value, if it has the variable's type
+            n->memory = ++n->last_memory;
+            IrInst load = *inst;
+            load.op = IR_LOAD;
+            load.a = load.b = IR_NONE;
+            if (fn->insts[inst->a].type == inst->type) insert(n, &load, n->memory, v, inst->a);
+            continue;
+        }
+        if (!is_numbered(inst->op)) continue;
+        if (inst->op == IR_BINARY && is_commutative(inst->kind) && inst->a > inst->b) {
+            const IrValue a = inst->a;
+            inst->a = inst->b;
+            inst->b = a;
+        }
+        const uint32_t memory = memory_of(inst, n->memory);
+        const IrValue same = find(n, inst, memory);
+        if (same != IR_NONE) {
+            inst->op = IR_COPY;
+            inst->a = same;
+            inst->b = IR_NONE;
+        } else {
+            insert(n, inst, memory, v, v);
+        }
+    }
+}
+
+static void number_function(Numbering* n, IrFunction* fn) {
+    const uint32_t count = fn->block_count;
+    if (count == 0) return;
+    n->fn = fn;
+    IrBlockId* idom = malloc(sizeof(IrBlockId) * count);
+    IrBlockId* first_child = malloc(sizeof(IrBlockId) * count);
+    IrBlockId* next_sibling = malloc(sizeof(IrBlockId) * count);
+    uint32_t* memory_out = malloc(sizeof(uint32_t) * count);
+    DomFrame* stack = malloc(sizeof(DomFrame) * count);
+    uint32_t buckets = 64;
+    while (buckets < fn->inst_count * 2) buckets *= 2;
+    n->buckets = malloc(sizeof(uint32_t) * buckets);
+    if (!idom || !first_child || !next_sibling || !memory_out || !stack || !n->buckets) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    memset(n->buckets, 0xff, sizeof(uint32_t) * buckets);
+    n->bucket_mask = buckets - 1;
+    n->entry_count = 0;
+
+    ir_dominators(fn, idom);
+    for (IrBlockId b = 0; b < count; b++) {
+        first_child[b] = IR_NONE;
+    }
+    // children in block order, so the walk below is deterministic
+    for (IrBlockId b = count; b-- > 1;) {
+        if (idom[b] == IR_NONE) continue;
+        next_sibling[b] = first_child[idom[b]];
+        first_child[idom[b]] = b;
+    }
+
+    uint32_t top = 0;
+    stack[top++] = (DomFrame){ 0, IR_NONE, 0 };
+    int entered = 0;
+    while (top > 0) {
+        DomFrame* frame = &stack[top - 1];
+        if (!entered) {
+            const IrBlock* b = &fn->blocks[frame->block];
+            frame->mark = n->entry_count;
+            const int straight = b->pred_count == 1 && b->preds[0] == idom[frame->block];
+            n->memory = straight ? memory_out[idom[frame->block]] : ++n->last_memory;
+            number_block(n, frame->block);
+            memory_out[frame->block] = n->memory;
+            frame->child = first_child[frame->block];
+        }
+        if (frame->child != IR_NONE) {
+            const IrBlockId child = frame->child;
+            frame->child = next_sibling[child];
+            stack[top++] = (DomFrame){ child, IR_NONE, 0 };
+            entered = 0;
+        } else {
+            pop_entries(n, frame->mark);
+            top--;
+            entered = 1;
+        }
+    }
+
+    // the copies go, phis may have become trivial
+    ir_simplify_phis(fn);
+    for (IrBlockId b = 0; b < count; b++) {
+        IrBlock* block = &fn->blocks[b];
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IrValue v = block->insts[k];
+            if (fn->insts[v].op == IR_COPY) fn->insts[v].block = IR_NONE;
+            else block->insts[kept++] = v;
+        }
+        block->count = kept;
+    }
+    free(idom);
+    free(first_child);
+    free(next_sibling);
+    free(memory_out);
+    free(stack);
+    free(n->buckets);
+    n->buckets = NULL;
+}
+
+void ir_number_values(IrProgram* program) {
+    Numbering n;
+    memset(&n, 0, sizeof(Numbering));
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        number_function(&n, &program->functions[f]);
+    }
+    free(n.entries);
+}
@@ -0,0 +1,349 @@
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Loop-invariant code motion
+ * Loops are the natural loops of the control flow graph: an edge to a block
+ * that dominates its source is a back edge, and the loop of a header is the
+ * header plus every block that reaches one of its back edges without going
+ * through it. The back edges to a header make one loop. Loops are handled
+ * innermost first (deepest header in the dominator tree), so what leaves an
+ * inner loop can leave the enclosing ones too.
+ *
+ * Code is moved to the loop's preheader, the single block outside the loop
+ * that jumps to the header. One is made if the header doesn't have it. An
+ * instruction is moved if it has no side effects and its operands are all
+ * defined outside the loop, which holds for more of them as others are moved,
+ * so the body is scanned until nothing moves:
+ * - loads only if the loop has no call and no store to the variable,
+ * - integer division and modulo only by a constant other than 0 and -1, a
+ *   while body may not run at all and the hoisted division must not trap
+ *   where the original never ran.
+ */
+
+typedef struct {
+    IrBlockId header;
+    uint32_t depth;             // Of the header in the dominator tree
+} Loop;
+
+typedef struct {
+    IrFunction* fn;
+    uint32_t* enter;            // Per block, preorder number in the dominator tree
+    uint32_t* leave;            // and the last one in its subtree
+    unsigned char* in_loop;     // Per block, set for the loop being handled
+    IrBlockId* body;            // Its blocks
+    uint32_t body_count;
+    uint32_t body_capacity;
+    unsigned char* stored;      // Per variable, stored in the loop
+    int* stored_vars;
+    uint32_t stored_count;
+    uint32_t stored_capacity;
+    int has_call;
+} Hoisting;
+
+static void* zalloc(size_t count, size_t size) {
+    void* array = calloc(count ? count : 1, size);
+    if (!array) {
+        fprintf(stderr, "No memory for the IR\n");
+        exit(1);
+    }
+    return array;
+}
+
+static int by_depth(const void* x, const void* y) {
+    const Loop* a = x;
+    const Loop* b = y;
+    if (a->depth != b->depth) return a->depth > b->depth ? -1 : 1;
+    return a->header < b->header ? -1 : a->header > b->header;
+}
+
+// Constant time, unlike walking up the idoms, which a long chain of ifs makes quadratic
+static int dominates(const Hoisting* h, IrBlockId a, IrBlockId b) {
+    return h->enter[a] <= h->enter[b] && h->leave[b] <= h->leave[a];
+}
+
+// Collects the blocks of the loop of header, its back edges come from blocks
+// it dominates. enter only knows the first old_count blocks, later ones are
+// preheaders and never a back edge's source
+static void collect_body(Hoisting* h, uint32_t old_count, IrBlockId header) {
+    IrFunction* fn = h->fn;
+    h->body_count = 0;
+    h->in_loop[header] = 1;
+    IR_PUSH(h->body, h->body_count, h->body_capacity, header);
+    const IrBlock* head = &fn->blocks[header];
+    for (uint32_t k = 0; k < head->pred_count; k++) {
+        const IrBlockId tail = head->preds[k];
+        if (tail >= old_count || h->in_loop[tail] || !dominates(h, header, tail)) continue;
+        h->in_loop[tail] = 1;
+        IR_PUSH(h->body, h->body_count, h->body_capacity, tail);
+    }
+    // the body doubles as the worklist, everything past the header still has preds to visit
+    for (uint32_t i = 1; i < h->body_count; i++) {
+        const IrBlock* block = &fn->blocks[h->body[i]];
+        for (uint32_t k = 0; k < block->pred_count; k++) {
+            const IrBlockId pred = block->preds[k];
+            if (h->in_loop[pred]) continue;
+            h->in_loop[pred] = 1;
+            IR_PUSH(h->body, h->body_count, h->body_capacity, pred);
+        }
+    }
+}
+
+static IrInst jump_to(IrBlockId target) {
+    IrInst inst;
+    memset(&inst, 0, sizeof(IrInst));
+    inst.op = IR_JUMP;
+    inst.type = TYPE_UNKNOWN;
+    inst.a = inst.b = IR_NONE;
+    inst.var = VAR_NONE;
+    inst.target[0] = target;
+    return inst;
+}
+
+// The header's only pred outside the loop if it just jumps there, else a new
+// block the outside preds go through
+static IrBlockId preheader(Hoisting* h, IrBlockId header) {
+    IrFunction* fn = h->fn;
+    uint32_t outside = 0;
+    IrBlockId pred = IR_NONE;
+    const IrBlock* head = &fn->blocks[header];
+    for (uint32_t k = 0; k < head->pred_count; k++) {
+        if (h->in_loop[head->preds[k]]) continue;
+        outside++;
+        pred = head->preds[k];
+    }
+    if (outside == 1) {
+        const IrBlock* block = &fn->blocks[pred];
+        if (block->count > 0 && fn->insts[block->insts[block->count - 1]].op == IR_JUMP) return pred;
+    }
+
+    const IrBlockId pre = ir_new_block(fn);
+    for (uint32_t k = 0; k < fn->blocks[header].pred_count; k++) {
+        const IrBlockId from = fn->blocks[header].preds[k];
+        if (h->in_loop[from]) continue;
+        ir_add_pred(fn, pre, from);
+        IrBlock* source = &fn->blocks[from];
+        IrInst* last = &fn->insts[source->insts[source->count - 1]];
+        if (last->target[0] == header) last->target[0] = pre;
+        if (last->op == IR_BRANCH && last->target[1] == header) last->target[1] = pre;
+    }
+    // with several outside preds the operands they bring meet in a phi in
+    // pre, the header gets that in the position of its first outside pred
+    IrValue* merged = zalloc(fn->blocks[header].phi_count, sizeof(IrValue));
+    for (uint32_t i = 0; i < fn->blocks[header].phi_count; i++) {
+        const IrValue phi = fn->blocks[header].phis[i];
+        const IrBlock* head = &fn->blocks[header];
+        if (outside == 1) {
+            for (uint32_t k = 0; k < head->pred_count; k++) {
+                if (!h->in_loop[head->preds[k]]) merged[i] = fn->operands[fn->insts[phi].args.first + k];
+            }
+            continue;
+        }
+        merged[i] = ir_emit_phi(fn, pre, fn->insts[phi].type, fn->insts[phi].var);
+        const uint32_t first = ir_add_operands(fn, outside);
+        fn->insts[merged[i]].args.first = first;
+        fn->insts[merged[i]].args.count = outside;
+        uint32_t taken = 0;
+        for (uint32_t k = 0; k < head->pred_count; k++) {
+            if (!h->in_loop[head->preds[k]]) fn->operands[first + taken++] = fn->operands[fn->insts[phi].args.first + k];
+        }
+    }
+    IrBlock* block = &fn->blocks[header];
+    uint32_t kept = 0;
+    int placed = 0;
+    for (uint32_t k = 0; k < block->pred_count; k++) {
+        const int inside = h->in_loop[block->preds[k]];
+        if (!inside && placed) continue;
+        for (uint32_t i = 0; i < block->phi_count; i++) {
+            const IrInst* inst = &fn->insts[block->phis[i]];
+            fn->operands[inst->args.first + kept] = inside ? fn->operands[inst->args.first + k] : merged[i];
+        }
+        block->preds[kept++] = inside ? block->preds[k] : pre;
+        placed |= !inside;
+    }
+    block->pred_count = kept;
+    for (uint32_t i = 0; i < block->phi_count; i++) {
+        fn->insts[block->phis[i]].args.count = kept;
+    }
+    free(merged);
+    ir_emit(fn, pre, jump_to(header));
+    return pre;
+}
+
+static int defined_outside(const Hoisting* h, IrValue v) {
+    return v == IR_NONE || !h->in_loop[h->fn->insts[v].block];
+}
+
+// Division of integers that can't trap whatever the dividend
+static int safe_division(const IrFunction* fn, const IrInst* inst) {
+    if (inst->type == TYPE_FLOAT) return 1;
+    const IrInst* divisor = &fn->insts[inst->b];
+    if (divisor->op != IR_CONST || divisor->type == TYPE_FLOAT || divisor->type == TYPE_STRING) return 0;
+    return divisor->value.u != 0 && divisor->value.u != (unsigned long long)-1;
+}
+
+static int is_invariant(const Hoisting* h, const IrInst* inst) {
+    switch (inst->op) {
+        case IR_CONST:
+            return 1;
+        case IR_LOAD:
+            return !h->has_call && !h->stored[inst->var];
+        case IR_BINARY:
+            if ((inst->kind == OP_DIV || inst->kind == OP_MOD) && !safe_division(h->fn, inst)) return 0;
+            return defined_outside(h, inst->a) && defined_outside(h, inst->b);
+        case IR_UNARY:
+        case IR_CONVERT:
+        case IR_FACTORIAL:
+            return defined_outside(h, inst->a);
+        default:
+            return 0;
+    }
+}
+
+// Moves the invariant code of the loop in h to its preheader, returns how many instructions moved
+static uint32_t hoist_loop(Hoisting* h, IrBlockId header) {
+    IrFunction* fn = h->fn;
+    h->has_call = 0;
+    h->stored_count = 0;
+    for (uint32_t i = 0; i < h->body_count; i++) {
+        const IrBlock* block = &fn->blocks[h->body[i]];
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IrInst* inst = &fn->insts[block->insts[k]];
+            if (inst->op == IR_CALL) h->has_call = 1;
+            if (inst->op == IR_STORE && !h->stored[inst->var]) {
+                h->stored[inst->var] = 1;
+                IR_PUSH(h->stored_vars, h->stored_count, h->stored_capacity, inst->var);
+            }
+        }
+    }
+
+    IrBlockId pre = IR_NONE;
+    uint32_t moved = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        // the body was collected walking back from the latches, so go the other way
+        for (uint32_t i = h->body_count; i-- > 0;) {
+            const IrBlockId b = h->body[i];
+            for (uint32_t k = 0; k < fn->blocks[b].count; k++) {
+                const IrValue v = fn->blocks[b].insts[k];
+                if (!is_invariant(h, &fn->insts[v])) continue;
+                if (pre == IR_NONE) pre = preheader(h, header);
+                // in front of the preheader's jump
+                IrBlock* into = &fn->blocks[pre];
+                const IrValue jump = into->insts[into->count - 1];
+                into->insts[into->count - 1] = v;
+                IR_PUSH(into->insts, into->count, into->capacity, jump);
+                fn->insts[v].block = pre;
+                IrBlock* from = &fn->blocks[b];
+                memmove(from->insts + k, from->insts + k + 1, sizeof(IrValue) * (from->count - k - 1));
+                from->count--;
+                k--;
+                moved++;
+                changed = 1;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < h->stored_count; i++) {
+        h->stored[h->stored_vars[i]] = 0;
+    }
+    return moved;
+}
+
+// Numbers the dominator tree depth first, unreached blocks keep enter IR_NONE
+static void number_tree(Hoisting* h, const IrBlockId* idom, uint32_t* depth) {
+    const uint32_t count = h->fn->block_count;
+    IrBlockId* first_child = zalloc(count, sizeof(IrBlockId));
+    IrBlockId* next_sibling = zalloc(count, sizeof(IrBlockId));
+    IrBlockId* stack = zalloc(count, sizeof(IrBlockId));
+    for (IrBlockId b = 0; b < count; b++) {
+        first_child[b] = IR_NONE;
+        h->enter[b] = IR_NONE;
+    }
+    for (IrBlockId b = count; b-- > 1;) {
+        if (idom[b] == IR_NONE) continue;
+        next_sibling[b] = first_child[idom[b]];
+        first_child[idom[b]] = b;
+    }
+    uint32_t top = 0;
+    uint32_t number = 0;
+    stack[top++] = 0;
+    h->enter[0] = number++;
+    while (top > 0) {
+        const IrBlockId b = stack[top - 1];
+        const IrBlockId child = first_child[b];
+        if (child == IR_NONE) {
+            h->leave[b] = number - 1;
+            top--;
+            continue;
+        }
+        first_child[b] = next_sibling[child];
+        h->enter[child] = number++;
+        depth[child] = depth[b] + 1;
+        stack[top++] = child;
+    }
+    free(first_child);
+    free(next_sibling);
+    free(stack);
+}
+
+static void hoist_function(Hoisting* h, IrFunction* fn) {
+    const uint32_t count = fn->block_count;
+    if (count == 0) return;
+    h->fn = fn;
+    IrBlockId* idom = zalloc(count, sizeof(IrBlockId));
+    IrBlockId* order = zalloc(count, sizeof(IrBlockId));
+    uint32_t* depth = zalloc(count, sizeof(uint32_t));
+    h->enter = zalloc(count, sizeof(uint32_t));
+    h->leave = zalloc(count, sizeof(uint32_t));
+    ir_dominators(fn, idom);
+    number_tree(h, idom, depth);
+    const uint32_t reached = ir_reverse_postorder(fn, order);
+
+    Loop* loops = NULL;
+    uint32_t loop_count = 0;
+    uint32_t loop_capacity = 0;
+    for (uint32_t i = 0; i < reached; i++) {
+        const IrBlockId b = order[i];
+        const IrBlock* block = &fn->blocks[b];
+        for (uint32_t k = 0; k < block->pred_count; k++) {
+            const IrBlockId pred = block->preds[k];
+            if (h->enter[pred] != IR_NONE && dominates(h, b, pred)) {
+                Loop loop = { b, depth[b] };
+                IR_PUSH(loops, loop_count, loop_capacity, loop);
+                break;
+            }
+        }
+    }
+    if (loop_count > 0) qsort(loops, loop_count, sizeof(Loop), by_depth);
+
+    // a loop adds at most one block, its preheader
+    h->in_loop = zalloc(count + loop_count, 1);
+    for (uint32_t i = 0; i < loop_count; i++) {
+        collect_body(h, count, loops[i].header);
+        hoist_loop(h, loops[i].header);
+        for (uint32_t k = 0; k < h->body_count; k++) {
+            h->in_loop[h->body[k]] = 0;
+        }
+    }
+    free(h->in_loop);
+    free(h->enter);
+    free(h->leave);
+    free(loops);
+    free(idom);
+    free(order);
+    free(depth);
+}
+
+void ir_hoist_invariants(IrProgram* program) {
+    Hoisting h;
+    memset(&h, 0, sizeof(Hoisting));
+    h.stored = zalloc(program->variable_count, 1);
+    for (uint32_t f = 0; f < program->function_count; f++) {
+        hoist_function(&h, &program->functions[f]);
+    }
+    free(h.stored);
+    free(h.body);
+    free(h.stored_vars);
+}
@@ -0,0 +1,90 @@
+/* keyword_gen.c
+ * Writes keyword_table.h, the perfect hash lexer.c looks keywords up with,
+ * from KEYWORD_KINDS. The build runs it whenever tokens.h changes:
+ *
+ *   ./keyword_gen path/to/keyword_table.h
+ *
+ * The hash mixes the first and last character with the length. The smallest
+ * power of two table is tried first, with every pair of multipliers, until
+ * each keyword gets a slot of its own, so a new keyword can't hide another.
+ * If no pair works the build fails here instead.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "tokens.h"
+
+#define MAX_MULTIPLIER 64
+#define MAX_SLOTS 256
+
+typedef struct {
+    const char* kind;
+    const char* text;
+} Keyword;
+
+static const Keyword keywords[] = {
+    #define X(kind, text) { #kind, text },
+    KEYWORD_KINDS
+    #undef X
+};
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+
+// Same as KEYWORD_HASH in the generated header
+static unsigned hash(const char* text, unsigned first, unsigned last, unsigned mask) {
+    const size_t len = strlen(text);
+    return ((unsigned char)text[0] * first + (unsigned char)text[len - 1] * last + (unsigned)len) & mask;
+}
+
+// Fills slots with keyword number + 1, returns 0 as soon as two share one
+static int is_perfect(unsigned first, unsigned last, unsigned size, unsigned char* slots) {
+    memset(slots, 0, size);
+    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+        const unsigned slot = hash(keywords[i].text, first, last, size - 1);
+        if (slots[slot]) return 0;
+        slots[slot] = (unsigned char)(i + 1);
+    }
+    return 1;
+}
+
+static int write_table(const char* path, unsigned first, unsigned last, unsigned size, const unsigned char* slots) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return 1;
+    }
+    size_t min_length = (size_t)-1, max_length = 0;
+    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+        const size_t len = strlen(keywords[i].text);
+        if (len < min_length) min_length = len;
+        if (len > max_length) max_length = len;
+    }
+    fprintf(out, "// Generated by keyword_gen from KEYWORD_KINDS in tokens.h, do not edit\n");
+    fprintf(out, "#define KEYWORD_HASH(s, len) \\\n");
+    fprintf(out, "    (((unsigned char)(s)[0] * %u + (unsigned char)(s)[(len) - 1] * %u + (len)) & %u)\n",
+            first, last, size - 1);
+    fprintf(out, "#define KEYWORD_MIN_LENGTH %zu\n", min_length);
+    fprintf(out, "#define KEYWORD_MAX_LENGTH %zu\n\n", max_length);
+    fprintf(out, "static const TokenKind keyword_table[%u] = {\n", size);
+    for (unsigned slot = 0; slot < size; slot++) {
+        if (slots[slot]) fprintf(out, "    [%u] = %s,\n", slot, keywords[slots[slot] - 1].kind);
+    }
+    fprintf(out, "};\n");
+    return fclose(out) == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s keyword_table.h\n", argv[0]);
+        return 1;
+    }
+    unsigned char slots[MAX_SLOTS];
+    for (unsigned size = 1; size <= MAX_SLOTS; size *= 2) {
+        if (size < KEYWORD_COUNT) continue;
+        for (unsigned first = 1; first < MAX_MULTIPLIER; first++) {
+            for (unsigned last = 1; last < MAX_MULTIPLIER; last++) {
+                if (is_perfect(first, last, size, slots)) return write_table(argv[1], first, last, size, slots);
+            }
+        }
+    }
+    fprintf(stderr, "keyword_gen: no perfect hash for KEYWORD_KINDS within %u slots\n", MAX_SLOTS);
+    return 1;
+}
@@ -0,0 +1,222 @@
+#include "lexer.h"
+#if defined(HAVE_PTHREAD) && defined(HAVE_SYSCONF)
+#define LEX_THREADS 1
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* Parallel lexing
+ * The input is cut into one chunk per thread, each starting just past a '\n'.
+ * Strings and line comments can't cross a newline, so a chunk start is a clean
+ * place to begin lexing unless it lies inside a block comment, which can't be
+ * known without lexing everything before it. Workers therefore lex their chunk
+ * speculatively and carry on past its end until the first token that starts in
+ * the next chunk. That token is where the next chunk really begins: the next
+ * worker's tokens from that exact position on are right, anything before it
+ * (the inside of a comment lexed as code) is dropped. If the next worker never
+ * produced a token there, its chunk is lexed again from where this one stopped.
+ *
+ * Lexing from a token start depends on nothing but the line number and the
+ * previous token type (consecutive operators), both are patched while the
+ * chunks are stitched together.
+ * Without pthreads the whole input is one chunk.
+ */
+#define MAX_THREADS 64
+
+typedef struct {
+    const char* input;
+    size_t length;
+    size_t begin;       // chunk is [begin, end), begin is 0 or just past a '\n'
+    size_t end;
+    int newlines;       // '\n' count in [begin, end)
+    int line_base;      // added to the chunk's line numbers to make them absolute
+    Token* tokens;      // tokens starting inside the chunk
+    size_t count;
+    size_t capacity;
+    Lexer stop;         // lexer state right before `next`
+    Token next;         // first token starting at or past end, or EOF
+    int failed;
+} Chunk;
+
+// Lexes from the current lexer state until a token starts at or past chunk->end
+static void lex_chunk(Chunk* chunk, Lexer* lexer) {
+    const char* end = chunk->input + chunk->end;
+    for (;;) {
+        Lexer before = *lexer;
+        Token token = get_next_token(lexer);
+        if (token.type == TOKEN_EOF || token.start >= end) {
+            chunk->stop = before;
+            chunk->next = token;
+            return;
+        }
+        if (chunk->count == chunk->capacity) {
+            size_t capacity = chunk->capacity ? chunk->capacity * 2 : TOKEN_CHUNK;
+            Token* grown = realloc(chunk->tokens, sizeof(Token) * capacity);
+            if (!grown) {
+                chunk->failed = 1;
+                return;
+            }
+            chunk->tokens = grown;
+            chunk->capacity = capacity;
+        }
+        chunk->tokens[chunk->count++] = token;
+    }
+}
+
+static void* lex_worker(void* arg) {
+    Chunk* chunk = arg;
+    Lexer lexer;
+    lexer_init(&lexer, chunk->input, chunk->length);
+    lexer.pos = chunk->begin;
+    lexer.line_start = chunk->begin;
+
+    const char* p = chunk->input + chunk->begin;
+    const char* end = chunk->input + chunk->end;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        chunk->newlines++;
+        p++;
+    }
+    lex_chunk(chunk, &lexer);
+    return NULL;
+}
+
+// Index of the token starting exactly at start, or count if there is none
+static size_t find_token(const Chunk* chunk, const char* start) {
+    size_t lo = 0, hi = chunk->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (chunk->tokens[mid].start < start) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < chunk->count && chunk->tokens[lo].start == start ? lo : chunk->count;
+}
+
+static int thread_count(size_t length) {
+#ifndef LEX_THREADS
+    (void)length;
+    return 1;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = length / PARALLEL_MIN_CHUNK;
+    if (cpus > 0 && threads > (size_t)cpus) threads = (size_t)cpus;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    return threads > 1 ? (int)threads : 1;
+#endif
+}
+
+Token* lex_table(const char* input, size_t length, size_t* count) {
+    int threads = thread_count(length);
+    Chunk chunks[MAX_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+
+    size_t begin = 0;
+    for (int i = 0; i < threads; i++) {
+        size_t end = length;
+        if (i + 1 < threads) {
+            end = length / threads * (i + 1);
+            if (end < begin) end = begin;
+            const char* nl = memchr(input + end, '\n', length - end);
+            end = nl ? (size_t)(nl - input) + 1 : length;
+        }
+        chunks[i].input = input;
+        chunks[i].length = length;
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    // the calling thread takes the first chunk itself
+    int started = 1;
+#ifdef LEX_THREADS
+    pthread_t workers[MAX_THREADS];
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, lex_worker, &chunks[started]) != 0) break;
+    }
+#endif
+    lex_worker(&chunks[0]);
+#ifdef LEX_THREADS
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+#endif
+    // chunks whose thread didn't start are relexed below like a bad split
+    for (int i = started; i < threads; i++) {
+        chunks[i].failed = 1;
+    }
+
+    size_t total = 1;
+    int line = 0;
+    for (int i = 0; i < threads; i++) {
+        chunks[i].line_base = line;
+        line += chunks[i].newlines;
+        total += chunks[i].count;
+    }
+
+    // the first chunk was lexed from the real start, its tokens are final as
+    // they are and become the table the others are appended to
+    Token* table = NULL;
+    size_t n = chunks[0].count;
+    if (!chunks[0].failed) {
+        table = realloc(chunks[0].tokens, sizeof(Token) * total);
+    }
+    if (table) chunks[0].tokens = NULL;
+
+    Chunk* prev = &chunks[0];
+    for (int i = 1; table && i < threads; i++) {
+        Chunk* chunk = &chunks[i];
+        if (prev->next.type == TOKEN_EOF) break;
+        size_t first = chunk->failed ? chunk->count : find_token(chunk, prev->next.start);
+        if (first == chunk->count) {
+            // no usable tokens, lex this chunk again from where prev stopped
+            Lexer lexer = prev->stop;
+            lexer.line += prev->line_base;
+            chunk->count = 0;
+            chunk->failed = 0;
+            chunk->line_base = 0;
+            lex_chunk(chunk, &lexer);
+            if (chunk->failed) {
+                free(table);
+                table = NULL;
+                break;
+            }
+            first = 0;
+        }
+
+        // this chunk's tokens were lexed with lines counted from its begin
+        // and without knowing the token before them
+        if (n + chunk->count - first + 1 > total) {
+            total = n + chunk->count - first + 1;
+            Token* grown = realloc(table, sizeof(Token) * total);
+            if (!grown) {
+                free(table);
+                table = NULL;
+                break;
+            }
+            table = grown;
+        }
+        for (size_t k = first; k < chunk->count; k++) {
+            Token token = chunk->tokens[k];
+            token.line += chunk->line_base;
+            if (k == first && token.type == TOKEN_OPERATOR) {
+                int consecutive = n > 0 && table[n - 1].type == TOKEN_OPERATOR &&
+                                  !IS_PREFIX_KIND(token.kind);
+                token.error = consecutive ? ERROR_CONSECUTIVE_OPERATORS : ERROR_NONE;
+            }
+            table[n++] = token;
+        }
+        prev = chunk;
+    }
+
+    if (table) {
+        // prev stopped at EOF, either at the very end or inside a comment
+        // that runs to the end of the input
+        Token eof = prev->next;
+        eof.line += prev->line_base;
+        table[n++] = eof;
+        *count = n;
+    }
+    for (int i = 0; i < threads; i++) {
+        free(chunks[i].tokens);
+    }
+    return table;
+}
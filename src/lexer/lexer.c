@@ -1,62 +1,299 @@
 #include "lexer.h"
 #include "tokens.h"
+#include "scan.h"
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 
-// For tracking line numbers during lexing
-static int current_line = 1;
+/* Character classes
+ * One lookup per character instead of scanning the delimiter/operator lists and
+ * calling into libc. Must stay in sync with OPERATOR_KINDS and DELIMITER_KINDS.
+ */
+enum {
+    CC_SPACE    = 1 << 0,   // ' ', '\t', '\n'
+    CC_DIGIT    = 1 << 1,   // 0-9
+    CC_ALPHA    = 1 << 2,   // letters and '_'
+    CC_OPERATOR = 1 << 3,   // first character of some operator
+    CC_DELIM    = 1 << 4,   // single character delimiters
+    CC_QUOTE    = 1 << 5,   // '"'
+};
 
+static const unsigned char char_class[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_ALPHA, ['A' ... 'Z'] = CC_ALPHA, ['_'] = CC_ALPHA,
+    ['='] = CC_OPERATOR, ['!'] = CC_OPERATOR, ['>'] = CC_OPERATOR, ['<'] = CC_OPERATOR,
+    ['+'] = CC_OPERATOR, ['-'] = CC_OPERATOR, ['*'] = CC_OPERATOR, ['/'] = CC_OPERATOR,
+    ['%'] = CC_OPERATOR, ['&'] = CC_OPERATOR, ['|'] = CC_OPERATOR, ['^'] = CC_OPERATOR,
+    ['~'] = CC_OPERATOR,
+    ['}'] = CC_DELIM, ['{'] = CC_DELIM, [']'] = CC_DELIM, ['['] = CC_DELIM,
+    [')'] = CC_DELIM, ['('] = CC_DELIM, [','] = CC_DELIM, [';'] = CC_DELIM,
+    ['"'] = CC_QUOTE,
+};
+#define CHAR_IS(c, cls) (char_class[(unsigned char)(c)] & (cls))
 
-// checks if [str, str+len) is in the keywords[] array
-int is_keyword(char* str, int len) {
-    for (int i = 0; i < NUM_KEYWORDS; i++) {
-        if (strncmp(str, keywords[i], len) == 0 && keywords[i][len] == '\0') {
-            return 1;
-        }
+static const char* kind_text[KIND_COUNT] = {
+    [KIND_NONE] = "",
+    #define X(kind, text) [kind] = text,
+    KEYWORD_KINDS
+    OPERATOR_KINDS
+    DELIMITER_KINDS
+    #undef X
+};
+
+static const TokenKind delimiter_kind[256] = {
+    ['}'] = DELIM_RBRACE, ['{'] = DELIM_LBRACE, [']'] = DELIM_RBRACKET, ['['] = DELIM_LBRACKET,
+    [')'] = DELIM_RPAREN, ['('] = DELIM_LPAREN, [','] = DELIM_COMMA, [';'] = DELIM_SEMICOLON,
+};
+
+/* Perfect hash for keywords
+ * keyword_table.h is generated from KEYWORD_KINDS at build time by
+ * keyword_gen.c, which picks multipliers that give every keyword its own
+ * slot. A lookup is one hash and one compare against the only candidate.
+ */
+#include "keyword_table.h"
+
+/* Operator DFA
+ * Maximal munch over OPERATOR_KINDS. The set is prefix closed (every prefix of
+ * an operator is an operator), so each DFA state is simply the operator kind
+ * matched so far and every state accepts: the lexer follows transitions until
+ * there are none and emits the state it stopped in, no backtracking needed.
+ * Generated from the operator trie, keep in sync with OPERATOR_KINDS.
+ */
+enum {
+    COL_NONE,
+    COL_EQ, COL_BANG, COL_GT, COL_LT, COL_PLUS, COL_MINUS,
+    COL_STAR, COL_SLASH, COL_PERCENT, COL_AMP, COL_PIPE, COL_CARET, COL_TILDE,
+    OPERATOR_COLUMNS
+};
+
+static const unsigned char operator_column[256] = {
+    ['='] = COL_EQ, ['!'] = COL_BANG, ['>'] = COL_GT, ['<'] = COL_LT,
+    ['+'] = COL_PLUS, ['-'] = COL_MINUS, ['*'] = COL_STAR, ['/'] = COL_SLASH,
+    ['%'] = COL_PERCENT, ['&'] = COL_AMP, ['|'] = COL_PIPE, ['^'] = COL_CARET,
+    ['~'] = COL_TILDE,
+};
+
+static const unsigned char operator_dfa[KIND_COUNT][OPERATOR_COLUMNS] = {
+    [KIND_NONE] = {
+        [COL_EQ] = OP_ASSIGN, [COL_BANG] = OP_NOT, [COL_GT] = OP_GT, [COL_LT] = OP_LT,
+        [COL_PLUS] = OP_ADD, [COL_MINUS] = OP_SUB, [COL_STAR] = OP_MUL, [COL_SLASH] = OP_DIV,
+        [COL_PERCENT] = OP_MOD, [COL_AMP] = OP_BITAND, [COL_PIPE] = OP_BITOR, [COL_CARET] = OP_XOR,
+        [COL_TILDE] = OP_BITNOT,
+    },
+    [OP_ASSIGN] = { [COL_EQ] = OP_EQ },
+    [OP_NOT]    = { [COL_EQ] = OP_NE },
+    [OP_GT]     = { [COL_EQ] = OP_GE, [COL_GT] = OP_SHR },
+    [OP_LT]     = { [COL_EQ] = OP_LE, [COL_LT] = OP_SHL },
+    [OP_ADD]    = { [COL_EQ] = OP_ADD_ASSIGN, [COL_PLUS] = OP_INC },
+    [OP_SUB]    = { [COL_EQ] = OP_SUB_ASSIGN, [COL_MINUS] = OP_DEC },
+    [OP_MUL]    = { [COL_EQ] = OP_MUL_ASSIGN },
+    [OP_DIV]    = { [COL_EQ] = OP_DIV_ASSIGN },
+    [OP_MOD]    = { [COL_EQ] = OP_MOD_ASSIGN },
+    [OP_SHR]    = { [COL_EQ] = OP_SHR_ASSIGN },
+    [OP_SHL]    = { [COL_EQ] = OP_SHL_ASSIGN },
+    [OP_BITAND] = { [COL_AMP] = OP_AND, [COL_EQ] = OP_BITAND_ASSIGN },
+    [OP_AND]    = { [COL_EQ] = OP_AND_ASSIGN },
+    [OP_BITOR]  = { [COL_PIPE] = OP_OR, [COL_EQ] = OP_BITOR_ASSIGN },
+    [OP_OR]     = { [COL_EQ] = OP_OR_ASSIGN },
+    [OP_XOR]    = { [COL_EQ] = OP_XOR_ASSIGN },
+};
+
+// Runs the operator DFA from str, returns the longest operator and its length in *len
+static inline TokenKind match_operator(const char* str, size_t max, int* len) {
+    TokenKind state = KIND_NONE;
+    int n = 0;
+    while ((size_t)n < max) {
+        TokenKind next = operator_dfa[state][operator_column[(unsigned char)str[n]]];
+        if (next == KIND_NONE) break;
+        state = next;
+        n++;
     }
-    return 0;
+    *len = n;
+    return state;
 }
 
-int is_operator(char* str, int len) {
-    for (int i = 0; i < NUM_OPERATORS; i++) {
-        if (strncmp(str, operators[i], len) == 0) {
-            return 1;
-        }
+// checks the hashed keyword candidate really is [str, str+len)
+static inline TokenKind match_kind(TokenKind kind, const char* str, int len) {
+    const char* text = kind_text[kind];
+    if (kind != KIND_NONE && strncmp(text, str, len) == 0 && text[len] == '\0') {
+        return kind;
     }
-    return 0;
+    return KIND_NONE;
 }
-int is_operator_start(char c) {
-    for (int i = 0; i < NUM_OPERATORS; i++) {
-        if (c == operators[i][0]) {
-            return 1;
+
+TokenKind keyword_kind(const char* str, int len) {
+    if (len < KEYWORD_MIN_LENGTH || len > KEYWORD_MAX_LENGTH) return KIND_NONE;
+    return match_kind(keyword_table[KEYWORD_HASH(str, len)], str, len);
+}
+
+TokenKind operator_kind(const char* str, int len) {
+    int matched;
+    TokenKind kind = match_operator(str, (size_t)len, &matched);
+    return matched == len ? kind : KIND_NONE;
+}
+
+const char* kind_to_string(TokenKind kind) {
+    return kind_text[kind];
+}
+
+void lexer_init(Lexer* lexer, const char* input, size_t length) {
+    lexer->input = input;
+    lexer->length = length;
+    lexer->pos = 0;
+    lexer->line = 1;
+    lexer->line_start = 0;
+    lexer->column = 1;
+    lexer->last = TOKEN_NONE;
+}
+
+// Reads the character offset bytes past the current position,
+// anything past the end of the buffer reads as '\0'
+static inline char peek(const Lexer* lexer, size_t offset) {
+    size_t pos = lexer->pos + offset;
+    return pos < lexer->length ? lexer->input[pos] : '\0';
+}
+
+/* Number literals
+ * Digits are accumulated into a 64 bit mantissa while scanning. Integers are
+ * exact or overflow. Floats take Clinger's fast path when the mantissa fits in
+ * a double's 53 bits and there are at most 22 fraction digits: both operands
+ * of the division are then exact and IEEE division rounds correctly. Anything
+ * longer goes through strtod.
+ */
+#define EXACT_MANTISSA (1ULL << 53)
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define NUM_EXACT_POW10 (int)(sizeof(exact_pow10) / sizeof(*exact_pow10))
+
+static double slow_float(const char* start, int length, int* overflow) {
+    char small[64];
+    char* buf = length < (int)sizeof(small) ? small : malloc((size_t)length + 1);
+    if (!buf) {
+        *overflow = 1;
+        return 0;
+    }
+    memcpy(buf, start, (size_t)length);
+    buf[length] = '\0';
+    errno = 0;
+    double value = strtod(buf, NULL);
+    if (errno == ERANGE && value != 0) *overflow = 1;
+    if (buf != small) free(buf);
+    return value;
+}
+
+static void lex_number(Lexer* lexer, Token* token) {
+    unsigned long long mantissa = 0;
+    int overflow = 0;
+    int decimals = 0;
+    int fraction_digits = 0;
+    char c = peek(lexer, 0);
+
+    while (CHAR_IS(c, CC_DIGIT) || c == '.') {
+        if (c == '.') {
+            decimals++;
+        } else {
+            unsigned digit = (unsigned)(c - '0');
+            if (mantissa > (ULLONG_MAX - digit) / 10) overflow = 1;
+            else mantissa = mantissa * 10 + digit;
+            if (decimals) fraction_digits++;
         }
+        lexer->pos++;
+        c = peek(lexer, 0);
+    }
+    token->length = (int)(lexer->input + lexer->pos - token->start);
+
+    if (decimals > 1) {
+        token->type = TOKEN_NUMBER;
+        token->error = ERROR_INVALID_NUMBER;
+        return;
+    }
+    if (decimals == 0) {
+        token->type = TOKEN_NUMBER;
+        if (overflow) token->error = ERROR_NUMBER_OVERFLOW;
+        else token->value.u = mantissa;
+        return;
+    }
+
+    token->type = TOKEN_FLOAT;
+    if (!overflow && mantissa <= EXACT_MANTISSA && fraction_digits < NUM_EXACT_POW10) {
+        token->value.f = (double)mantissa / exact_pow10[fraction_digits];
+        return;
     }
-    return 0;
+    overflow = 0;
+    token->value.f = slow_float(token->start, token->length, &overflow);
+    if (overflow) token->error = ERROR_NUMBER_OVERFLOW;
+}
+
+// Consumes the '\n' at the current position
+static inline void next_line(Lexer* lexer) {
+    lexer->pos++;
+    lexer->line++;
+    lexer->line_start = lexer->pos;
+}
+
+
+// checks if [str, str+len) is a keyword
+int is_keyword(const char* str, int len) {
+    return keyword_kind(str, len) != KIND_NONE;
+}
+
+int is_operator(const char* str, int len) {
+    return operator_kind(str, len) != KIND_NONE;
+}
+int is_operator_start(char c) {
+    return CHAR_IS(c, CC_OPERATOR) != 0;
 }
 
 int is_delimiter(char c) {
-    for (int i = 0; i < NUM_DELIMITERS; i++) {
-        if (c == delimiters[i]) return 1;
-    }
-    return 0;
+    return CHAR_IS(c, CC_DELIM) != 0;
 }
 
-void print_error(ErrorType error, int line, const char *lexeme) {
-    printf("Lexical Error at line %d: ", line);
-    switch (error) {
+// checks if the lexeme of t is exactly str
+int token_is(const Token t, const char* str) {
+    size_t len = strlen(str);
+    return (size_t)t.length == len && memcmp(t.start, str, len) == 0;
+}
+
+// Materializes the lexeme of t into buf as a NUL-terminated string
+// Returns the number of bytes copied, the lexeme is cut short if buf is too small
+size_t token_copy(const Token t, char* buf, size_t size) {
+    if (size == 0) return 0;
+    size_t len = (size_t)t.length < size - 1 ? (size_t)t.length : size - 1;
+    memcpy(buf, t.start, len);
+    buf[len] = '\0';
+    return len;
+}
+
+void print_error(Token token) {
+    printf("Lexical Error at line %d: ", token.line);
+    switch (token.error) {
         case ERROR_INVALID_CHAR:
-            printf("Invalid character '%s'\n", lexeme);
+            printf("Invalid character '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         case ERROR_INVALID_NUMBER:
-            printf("Invalid number format\n");
+            printf("Invalid number format '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         case ERROR_CONSECUTIVE_OPERATORS:
             printf("Consecutive operators not allowed\n");
             break;
         case ERROR_UNKNOWN_TYPE:
-            printf("Unknown type for token %s\n", lexeme);
+            printf("Unknown type for token " TOKEN_FMT "\n", TOKEN_ARG(token));
+            break;
+        case ERROR_UNTERMINATED_STRING:
+            printf("Unterminated string \"" TOKEN_FMT "\n", TOKEN_ARG(token));
+            break;
+        case ERROR_INVALID_ESCAPE:
+            printf("Invalid escape " TOKEN_FMT "\n", TOKEN_ARG(token));
+            break;
+        case ERROR_NUMBER_OVERFLOW:
+            printf("Number literal out of range '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         default:
             printf("Unknown error\n");
@@ -65,7 +302,7 @@ void print_error(ErrorType error, int line, const char *lexeme) {
 
 void print_token(Token token) {
     if (token.error != ERROR_NONE) {
-        print_error(token.error, token.line, token.lexeme);
+        print_error(token);
         return;
     }
 
@@ -74,6 +311,9 @@ void print_token(Token token) {
         case TOKEN_NUMBER:
             printf("NUMBER");
             break;
+        case TOKEN_FLOAT:
+            printf("FLOAT");
+            break;
         case TOKEN_OPERATOR:
             printf("OPERATOR");
             break;
@@ -84,12 +324,11 @@ void print_token(Token token) {
             printf("IDENTIFIER");
             break;
         case TOKEN_STRING:
+            // The span is the raw source between the quotes, escapes are kept as written
             printf("STRING_LITERAL | Lexeme: \"");
-            for (int j = 0; token.lexeme[j] != '\0'; j++) {
-                if (token.lexeme[j] == '\n') printf("\\n");
-                else if (token.lexeme[j] == '\t') printf("\\t");
-                else if (token.lexeme[j] == '\"') printf("\\\"");
-                else printf("%c", token.lexeme[j]);
+            for (int j = 0; j < token.length; j++) {
+                if (token.start[j] == '\t') printf("\\t");
+                else printf("%c", token.start[j]);
             }
             printf("\" | Line: %d\n", token.line);
             return;
@@ -102,212 +341,225 @@ void print_token(Token token) {
         default:
             printf("UNKNOWN %d", token.type);
     }
-    printf(" | Lexeme: '%s' | Line: %d\n",
-            token.lexeme, token.line);
+    printf(" | Lexeme: '" TOKEN_FMT "' | Line: %d\n",
+            TOKEN_ARG(token), token.line);
 }
 
-void skip_whitespace(const char* input, int *pos, int *current_line) {
-    char c;
-    int found_comment = 0;
-    while ((c = input[*pos]) != '\0' && (c == ' ' || c == '\n' || c == '\t' || c == '/') ) {
-        if (c == '\n') {
-            (*current_line)++;
-            (*pos)++;
-            continue;
-        }
+void skip_whitespace(Lexer* lexer) {
+    for (;;) {
+        lexer->pos = scanner.space(lexer->input, lexer->pos, lexer->length,
+                                   &lexer->line, &lexer->line_start);
+        if (peek(lexer, 0) != '/') return;
 
-        // Skip line comments: "//"
-        if ((input[*pos] == '/' && input[*pos + 1] == '/')) {
-            found_comment = 1;
-            (*pos) += 2;
-            while (input[*pos] != '\0' && input[*pos] != '\n') {
-                (*pos)++;
-            };
-            continue;
+        // Skip line comments: "//", the '\n' is left for the next round
+        if (peek(lexer, 1) == '/') {
+            lexer->pos = scanner.to_newline(lexer->input, lexer->pos + 2, lexer->length);
         }
         // Skip block comments: "/*...*/"
-        else if (input[*pos] == '/' && input[*pos + 1] == '*') {
-            (*pos) += 2;
-            while (input[*pos] != '\0' &&
-                   !(input[*pos] == '*' && input[*pos + 1] == '/'))
-            {
-                if (input[*pos] == '\n') {
-                    (*current_line)++;
-                }
-                (*pos)++;
-            }
+        else if (peek(lexer, 1) == '*') {
+            lexer->pos = scanner.comment(lexer->input, lexer->pos + 2, lexer->length,
+                                         &lexer->line, &lexer->line_start);
             // skip the '*/'
-            if (input[*pos] == '*') (*pos)++;
-            if (input[*pos] == '/') (*pos)++;
-            continue;
-        } else if (input[*pos] == '/'){
-            break;
+            if (lexer->pos < lexer->length) lexer->pos += 2;
+        } else {
+            return;
         }
-        (*pos)++;
     }
 }
 
-Token get_next_token(const char *input, int *pos, TokenType last_token_type) {
-    Token token = {TOKEN_ERROR, "", current_line, ERROR_NONE};
+static Token lex_token(Lexer* lexer) {
+    Token token = {
+        .type = TOKEN_ERROR, .kind = KIND_NONE, .error = ERROR_NONE, .id = INTERN_NONE,
+        .start = "", .length = 0, .line = lexer->line, .value = { 0 },
+    };
     char c;
 
     // Skip whitespace + track line numbers
-    skip_whitespace(input, pos, &current_line);
-    c = input[*pos];
+    skip_whitespace(lexer);
+    lexer->column = (int)(lexer->pos - lexer->line_start) + 1;
+    token.line = lexer->line;
+    token.start = lexer->input + lexer->pos;
+    c = peek(lexer, 0);
     // If end of input => TOKEN_EOF
-    if (c == '\0') {
+    if (lexer->pos >= lexer->length) {
         token.type = TOKEN_EOF;
-        strcpy(token.lexeme, "EOF");
+        token.start = "EOF";
+        token.length = 3;
         return token;
     }
 
     // If c is a delimiter => return TOKEN_DELIMITER
-    if (is_delimiter(c)) {
-        token.lexeme[0] = c;
-        token.lexeme[1] = '\0';
+    const unsigned char cls = char_class[(unsigned char)c];
+    if (cls & CC_DELIM) {
+        token.length = 1;
+        token.kind = delimiter_kind[(unsigned char)c];
         token.type = TOKEN_DELIMITER;
-        (*pos)++;
+        lexer->pos++;
         return token;
     }
 
     //  If c is a double-quote => parse string literal
-    if (c == '"') {
-        int i = 0;
-        (*pos)++; // skip opening quote
-        c = input[*pos];
+    if (cls & CC_QUOTE) {
+        lexer->pos++; // skip opening quote
+        token.start = lexer->input + lexer->pos;
 
-        while (c != '"' && c != '\0' && i < (int)sizeof(token.lexeme) - 1) {
+        for (;;) {
+            // jump straight to the next quote, backslash or newline
+            lexer->pos = scanner.string(lexer->input, lexer->pos, lexer->length);
+            c = peek(lexer, 0);
+            if (c == '"' || lexer->pos >= lexer->length) break;
             if (c == '\n') {
                 // unterminated string => error
-                token.error = ERROR_INVALID_CHAR;
-                snprintf(token.lexeme, sizeof(token.lexeme), "Unterminated string at line %d", current_line);
-                // skip until next line
-                while (input[*pos] != '\0' && input[*pos] != '\n') {
-                    (*pos)++;
-                }
-                if (input[*pos] == '\n') {
-                    current_line++;
-                    (*pos)++;
-                }
+                token.error = ERROR_UNTERMINATED_STRING;
+                token.length = (int)(lexer->input + lexer->pos - token.start);
+                next_line(lexer);
                 return token;
             }
-            // handle escape sequences
+            // validate escape sequences, the lexeme keeps them as written
             if (c == '\\') {
-                (*pos)++;
-                c = input[*pos];
+                lexer->pos++;
+                c = peek(lexer, 0);
                 switch (c) {
-                    case 'n':  token.lexeme[i++] = '\\'; token.lexeme[i++] = 'n'; break;
-                    case 't':  token.lexeme[i++] = '\\'; token.lexeme[i++] = 't'; break;
-                    case '\\': token.lexeme[i++] = '\\'; break;
-                    case '"':  token.lexeme[i++] = '\"'; break;
+                    case 'n':
+                    case 't':
+                    case '\\':
+                    case '"':
+                        break;
                     default:
-                        token.error = ERROR_INVALID_CHAR;
-                        snprintf(token.lexeme, sizeof(token.lexeme), "Invalid escape \\%c", c);
+                        token.error = ERROR_INVALID_ESCAPE;
+                        token.start = lexer->input + lexer->pos - 1;
+                        token.length = 2;
                         // skip rest of line
-                        while (input[*pos] != '\0' && input[*pos] != '\n') {
-                            (*pos)++;
-                        }
-                        if (input[*pos] == '\n') {
-                            current_line++;
-                            (*pos)++;
+                        lexer->pos = scanner.to_newline(lexer->input, lexer->pos, lexer->length);
+                        if (peek(lexer, 0) == '\n') {
+                            next_line(lexer);
                         }
                         return token;
                 }
-            } else {
-                token.lexeme[i++] = c;
             }
-            (*pos)++;
-            c = input[*pos];
+            lexer->pos++;
         }
 
+        token.length = (int)(lexer->input + lexer->pos - token.start);
         // check if we ended properly
-        if (c == '\0') {
-            token.error = ERROR_INVALID_CHAR;
-            snprintf(token.lexeme, sizeof(token.lexeme),
-                     "Unterminated string at line %d", current_line);
+        if (lexer->pos >= lexer->length) {
+            token.error = ERROR_UNTERMINATED_STRING;
             return token;
         }
         // else c == '"', so close the string
-        (*pos)++; // skip closing quote
-        token.lexeme[i] = '\0';
+        lexer->pos++; // skip closing quote
         token.type = TOKEN_STRING;
+        token.id = intern(token.start, (size_t)token.length);
         return token;
     }
 
     // If c is a digit => parse number
-    if (isdigit(c)) {
-        int i = 0;
-        int found_decimals = 0;
-        while ((isdigit(c) || c == '.') && i < (int)sizeof(token.lexeme) - 1) {
-            if (c == '.') {
-                found_decimals++;
-            }
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        }
-        token.lexeme[i] = '\0';
-        if (found_decimals > 1) {
-            token.error = ERROR_INVALID_NUMBER;
-            fprintf(stderr, "Invalid float literal with multiple decimals %s\n", token.lexeme);
-        }
-        token.type = TOKEN_NUMBER;
+    if (cls & CC_DIGIT) {
+        lex_number(lexer, &token);
         return token;
     }
 
     // If c is a letter or underscore => begin parsing identifier/keyword
-    if (isalpha(c) || c == '_') {
-        int i = 0;
-        while ((isdigit(c) || isalpha(c) || c == '_') && i < (int)sizeof(token.lexeme) - 1) {
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        }
-        token.lexeme[i] = '\0';
+    if (cls & CC_ALPHA) {
+        lexer->pos = scanner.ident(lexer->input, lexer->pos + 1, lexer->length);
+        token.length = (int)(lexer->input + lexer->pos - token.start);
 
         // check if it's keyword
-        if (is_keyword(token.lexeme, i)) {
+        token.kind = keyword_kind(token.start, token.length);
+        if (token.kind != KIND_NONE) {
             token.type = TOKEN_KEYWORD;
         }
         else {
             token.type = TOKEN_IDENTIFIER;
+            token.id = intern(token.start, (size_t)token.length);
         }
         return token;
     }
 
-    if (is_operator_start(c)) {
-        int i = 0;
-        while ((c != ' ' && c != '\n') && i < sizeof(token.lexeme)) {
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        }
-        if (is_operator(token.lexeme, i)) {
-            token.type = TOKEN_OPERATOR;
-            // check consecutive operators
-            if (last_token_type == TOKEN_OPERATOR) {
-                token.error = ERROR_CONSECUTIVE_OPERATORS;
-            }
+    if (cls & CC_OPERATOR) {
+        token.kind = match_operator(token.start, lexer->length - lexer->pos, &token.length);
+        lexer->pos += token.length;
+        token.type = TOKEN_OPERATOR;
+        // check consecutive operators, prefix operators may follow another one
+        if (lexer->last == TOKEN_OPERATOR && !IS_PREFIX_KIND(token.kind)) {
+            token.error = ERROR_CONSECUTIVE_OPERATORS;
         }
         return token;
     }
 
     //  reach here => unknown or invalid character
     token.error = ERROR_INVALID_CHAR;
-    token.lexeme[0] = c;
-    token.lexeme[1] = '\0';
-    (*pos)++;
+    token.length = 1;
+    lexer->pos++;
     return token;
 }
 
-void print_token_stream(const char* input) {
-    int position = 0;
+Token get_next_token(Lexer* lexer) {
+    Token token = lex_token(lexer);
+    lexer->last = token.type;
+    return token;
+}
+
+void token_stream_init(TokenStream* stream, const char* input, size_t length) {
+    memset(stream, 0, sizeof(TokenStream));
+    lexer_init(&stream->lexer, input, length);
+    if (length >= 2 * PARALLEL_MIN_CHUNK) {
+        // falls back to lexing on demand if the table can't be built
+        stream->table = lex_table(input, length, &stream->table_count);
+    }
+}
+
+void token_stream_free(TokenStream* stream) {
+    free(stream->table);
+    stream->table = NULL;
+}
+
+static inline Token token_stream_lex(TokenStream* stream) {
+    if (!stream->table) {
+        return get_next_token(&stream->lexer);
+    }
+    // keep handing out the EOF once the table runs out
+    Token token = stream->table[stream->table_pos];
+    if (stream->table_pos + 1 < stream->table_count) stream->table_pos++;
+    return token;
+}
+
+// Lex tokens into the ring until it holds at least k + 1 of them
+static void token_stream_fill(TokenStream* stream, int k) {
+    while (stream->count <= k) {
+        Token token = token_stream_lex(stream);
+        if (token.error != ERROR_NONE) {
+            print_error(token);
+        }
+        stream->ring[(stream->head + stream->count) & (LOOKAHEAD - 1)] = token;
+        stream->count++;
+    }
+}
+
+Token token_stream_next(TokenStream* stream) {
+    token_stream_fill(stream, 0);
+    Token token = stream->ring[stream->head];
+    stream->head = (stream->head + 1) & (LOOKAHEAD - 1);
+    stream->count--;
+    return token;
+}
+
+Token token_stream_peek(TokenStream* stream, int k) {
+    if (k >= LOOKAHEAD) {
+        fprintf(stderr, "Token lookahead of %d is too far\n", k);
+        exit(1);
+    }
+    token_stream_fill(stream, k);
+    return stream->ring[(stream->head + k) & (LOOKAHEAD - 1)];
+}
+
+void print_token_stream(const char* input, size_t length) {
+    Lexer lexer;
     Token token;
-    TokenType last = TOKEN_NONE;
+    lexer_init(&lexer, input, length);
     
     do {
-        token = get_next_token(input, &position, last);
-        last = token.type;
+        token = get_next_token(&lexer);
         print_token(token);
     } while (token.type != TOKEN_EOF);
 }
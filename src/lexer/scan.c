@@ -0,0 +1,176 @@
+#include "scan.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Mask of the bits below the lowest set bit of mask
+static inline uint32_t below(uint32_t mask) {
+    return (mask & -mask) - 1;
+}
+
+// Accounts for the newlines in nl, a mask over the bytes starting at base
+static inline void count_lines(uint32_t nl, size_t base, int* line, size_t* line_start) {
+    if (nl) {
+        *line += __builtin_popcount(nl);
+        *line_start = base + 32 - (size_t)__builtin_clz(nl);
+    }
+}
+
+/* Scalar scanners
+ * Used as is when nothing better is available, and by the vector scanners for
+ * the tail of the input that doesn't fill a whole vector.
+ */
+static size_t scalar_space(const char* input, size_t pos, size_t length, int* line, size_t* line_start) {
+    for (; pos < length; pos++) {
+        char c = input[pos];
+        if (c == '\n') {
+            (*line)++;
+            *line_start = pos + 1;
+        } else if (c != ' ' && c != '\t') {
+            break;
+        }
+    }
+    return pos;
+}
+
+static size_t scalar_comment(const char* input, size_t pos, size_t length, int* line, size_t* line_start) {
+    for (; pos < length; pos++) {
+        char c = input[pos];
+        if (c == '\n') {
+            (*line)++;
+            *line_start = pos + 1;
+        } else if (c == '*' && pos + 1 < length && input[pos + 1] == '/') {
+            break;
+        }
+    }
+    return pos;
+}
+
+static size_t scalar_to_newline(const char* input, size_t pos, size_t length) {
+    const char* nl = memchr(input + pos, '\n', length - pos);
+    return nl ? (size_t)(nl - input) : length;
+}
+
+static size_t scalar_ident(const char* input, size_t pos, size_t length) {
+    for (; pos < length; pos++) {
+        unsigned char c = (unsigned char)input[pos];
+        if (!((unsigned char)((c | 0x20) - 'a') <= 'z' - 'a' ||
+              (unsigned char)(c - '0') <= 9 || c == '_')) {
+            break;
+        }
+    }
+    return pos;
+}
+
+static size_t scalar_string(const char* input, size_t pos, size_t length) {
+    for (; pos < length; pos++) {
+        char c = input[pos];
+        if (c == '"' || c == '\\' || c == '\n') break;
+    }
+    return pos;
+}
+
+#ifdef SCAN_X86
+
+/* SSE2, 16 bytes at a time
+ * SSE2 only has signed byte compares, range checks go through an unsigned
+ * min instead: (x - lo) <= (hi - lo) iff min(x - lo, hi - lo) == x - lo.
+ */
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static inline __m128i sse2_load(const char* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+SSE2 static inline uint32_t sse2_eq(__m128i v, char c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+SSE2 static inline __m128i sse2_or(__m128i v, char c) {
+    return _mm_or_si128(v, _mm_set1_epi8(c));
+}
+SSE2 static inline uint32_t sse2_range(__m128i v, char lo, char hi) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8((char)(hi - lo))), t));
+}
+
+#define SCAN_ISA sse2
+#define SCAN_VEC __m128i
+#define SCAN_WIDTH 16
+#define SCAN_TARGET SSE2
+#include "scan_simd.h"
+#undef SCAN_ISA
+#undef SCAN_VEC
+#undef SCAN_WIDTH
+#undef SCAN_TARGET
+
+// AVX2, 32 bytes at a time, same tricks
+#define AVX2 __attribute__((target("avx2,popcnt")))
+
+AVX2 static inline __m256i avx2_load(const char* p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+AVX2 static inline uint32_t avx2_eq(__m256i v, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+AVX2 static inline __m256i avx2_or(__m256i v, char c) {
+    return _mm256_or_si256(v, _mm256_set1_epi8(c));
+}
+AVX2 static inline uint32_t avx2_range(__m256i v, char lo, char hi) {
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8((char)(hi - lo))), t));
+}
+
+#define SCAN_ISA avx2
+#define SCAN_VEC __m256i
+#define SCAN_WIDTH 32
+#define SCAN_TARGET AVX2
+#include "scan_simd.h"
+#undef SCAN_ISA
+#undef SCAN_VEC
+#undef SCAN_WIDTH
+#undef SCAN_TARGET
+
+#endif
+
+static const Scanner scanners[] = {
+#ifdef SCAN_X86
+    {"avx2", avx2_space, avx2_comment, avx2_to_newline, avx2_ident, avx2_string},
+    {"sse2", sse2_space, sse2_comment, sse2_to_newline, sse2_ident, sse2_string},
+#endif
+    {"scalar", scalar_space, scalar_comment, scalar_to_newline, scalar_ident, scalar_string},
+};
+#define NUM_SCANNERS (sizeof(scanners) / sizeof(*scanners))
+
+Scanner scanner = {"scalar", scalar_space, scalar_comment, scalar_to_newline, scalar_ident, scalar_string};
+
+static int cpu_supports(const char* name) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+int scan_use(const char* name) {
+    for (size_t i = 0; i < NUM_SCANNERS; i++) {
+        if (strcmp(scanners[i].name, name) == 0 && cpu_supports(name)) {
+            scanner = scanners[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Picks the best implementation before main() runs, so lexers on other
+// threads never see it change
+__attribute__((constructor)) static void scan_select(void) {
+    for (size_t i = 0; i < NUM_SCANNERS; i++) {
+        if (scan_use(scanners[i].name) == 0) return;
+    }
+}
@@ -0,0 +1,81 @@
+/* scan_simd.h
+ * Vector scanner template, included by scan.c once per instruction set with
+ *   SCAN_ISA     prefix of the vector primitives and of the generated scanners
+ *   SCAN_VEC     vector type
+ *   SCAN_WIDTH   bytes per vector (at most 32, masks are uint32_t)
+ *   SCAN_TARGET  function attribute enabling the instruction set
+ * The primitives ISA_load, ISA_eq, ISA_range and ISA_or must already exist and
+ * return one mask bit per byte. Whatever is left past the last full vector is
+ * handed to the scalar scanners.
+ */
+#define SCAN_CAT_(a, b) a##_##b
+#define SCAN_CAT(a, b) SCAN_CAT_(a, b)
+#define V(name) SCAN_CAT(SCAN_ISA, name)
+#define SCAN_FULL ((uint32_t)(((uint64_t)1 << SCAN_WIDTH) - 1))
+
+SCAN_TARGET static size_t V(space)(const char* input, size_t pos, size_t length, int* line, size_t* line_start) {
+    while (pos + SCAN_WIDTH <= length) {
+        SCAN_VEC v = V(load)(input + pos);
+        uint32_t nl = V(eq)(v, '\n');
+        uint32_t stop = ~(nl | V(eq)(v, ' ') | V(eq)(v, '\t')) & SCAN_FULL;
+        if (stop) {
+            count_lines(nl & below(stop), pos, line, line_start);
+            return pos + (size_t)__builtin_ctz(stop);
+        }
+        count_lines(nl, pos, line, line_start);
+        pos += SCAN_WIDTH;
+    }
+    return scalar_space(input, pos, length, line, line_start);
+}
+
+SCAN_TARGET static size_t V(comment)(const char* input, size_t pos, size_t length, int* line, size_t* line_start) {
+    // the second load looks one byte ahead, so "*/" is found even across vectors
+    while (pos + SCAN_WIDTH < length) {
+        SCAN_VEC v = V(load)(input + pos);
+        uint32_t nl = V(eq)(v, '\n');
+        uint32_t stop = V(eq)(v, '*') & V(eq)(V(load)(input + pos + 1), '/');
+        if (stop) {
+            count_lines(nl & below(stop), pos, line, line_start);
+            return pos + (size_t)__builtin_ctz(stop);
+        }
+        count_lines(nl, pos, line, line_start);
+        pos += SCAN_WIDTH;
+    }
+    return scalar_comment(input, pos, length, line, line_start);
+}
+
+SCAN_TARGET static size_t V(to_newline)(const char* input, size_t pos, size_t length) {
+    while (pos + SCAN_WIDTH <= length) {
+        uint32_t stop = V(eq)(V(load)(input + pos), '\n');
+        if (stop) return pos + (size_t)__builtin_ctz(stop);
+        pos += SCAN_WIDTH;
+    }
+    return scalar_to_newline(input, pos, length);
+}
+
+SCAN_TARGET static size_t V(ident)(const char* input, size_t pos, size_t length) {
+    while (pos + SCAN_WIDTH <= length) {
+        SCAN_VEC v = V(load)(input + pos);
+        // setting bit 5 folds upper case onto lower case
+        uint32_t ok = V(range)(V(or)(v, 0x20), 'a', 'z') | V(range)(v, '0', '9') | V(eq)(v, '_');
+        uint32_t stop = ~ok & SCAN_FULL;
+        if (stop) return pos + (size_t)__builtin_ctz(stop);
+        pos += SCAN_WIDTH;
+    }
+    return scalar_ident(input, pos, length);
+}
+
+SCAN_TARGET static size_t V(string)(const char* input, size_t pos, size_t length) {
+    while (pos + SCAN_WIDTH <= length) {
+        SCAN_VEC v = V(load)(input + pos);
+        uint32_t stop = V(eq)(v, '"') | V(eq)(v, '\\') | V(eq)(v, '\n');
+        if (stop) return pos + (size_t)__builtin_ctz(stop);
+        pos += SCAN_WIDTH;
+    }
+    return scalar_string(input, pos, length);
+}
+
+#undef SCAN_FULL
+#undef V
+#undef SCAN_CAT
+#undef SCAN_CAT_
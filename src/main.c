@@ -2,37 +2,53 @@
 #include <stdio.h>
 #include "parser.h"
 #include "semantic.h"
+#include "source.h"
+#include "ir.h"
+
+// Lowers a program that parsed and checked cleanly and prints the IR
+static void lower_program(const FlatAST* ast, const SymbolTable* table) {
+    IrProgram ir;
+    if (ir_build(&ir, ast, table) != 0) {
+        fprintf(stderr, "No memory for the IR\n");
+        return;
+    }
+    ir_eliminate_dead_code(&ir);
+    ir_hoist_invariants(&ir);
+    ir_number_values(&ir);
+    printf("\n--- IR ---\n");
+    ir_print(&ir);
+    ir_free(&ir);
+}
 
-#define MAXBUFLEN 1000000
 int main(int argc, char* argv[]) {
-    char* input = malloc(MAXBUFLEN * sizeof(char));
     if (argc == 2) {
-        const char* file = argv[1]; 
-        FILE *fp = fopen(file, "r");
-        if (fp != NULL) {
-            size_t new_len = fread(input, sizeof(char), MAXBUFLEN, fp);
-            if ( ferror( fp ) != 0 ) {
-                fputs("Error reading file", stderr);
-            } else {
-                input[new_len++] = '\0'; /* Just to be safe. */
-            }
-            fclose(fp);
+        // "-" reads the program from stdin
+        SourceBuffer source;
+        if (source_open(&source, argv[1]) != 0) {
+            fprintf(stderr, "Failed to read %s\n", argv[1]);
+            return 1;
         }
-        PARSE_INFO("Analyzing input:\n%s\n\n", input);
+        PARSE_INFO("Analyzing input:\n%.*s\n\n", (int)source.length, source.data);
 #ifdef DEBUG
-        print_token_stream(testInputs[i]);
+        print_token_stream(source.data, source.length);
 #endif
-        Parser parser = new_parser(input);
+        Parser parser = new_parser(source.data, source.length);
         parse(&parser);
         // using this so that the parse 
         //parse(&parser);
 
-        analyze_semantics(parser.root);
+        SymbolTable* table = init_symbol_table();
+        if (table) {
+            if (analyze_semantics_with(&parser.ast, table) && parser.errors == 0) lower_program(&parser.ast, table);
+            free_symbol_table(table);
+        } else {
+            analyze_semantics(&parser.ast);
+        }
 
         free_parser(parser);
         // parse(&parser);
         //free_parser(parser);
-        free(input);
+        source_close(&source);
     } else {
         const char* testInputs[] = {
         "int main(int argc, string argv){int y = 3; int x; x += 2 * 4 + 2;}",
@@ -56,19 +72,25 @@ int main(int argc, char* argv[]) {
         size_t NUM_TESTS = sizeof(testInputs) / sizeof(testInputs[0]);
         NUM_TESTS = 1;
 
+        // one table for the whole batch, it is reset between programs
+        SymbolTable* table = init_symbol_table();
         for (size_t i = 0; i < NUM_TESTS; i++) {
             PARSE_INFO("\n=== Test #%zu ===\nSource: %s\n", i+1, testInputs[i]);
-            Parser parser = new_parser((char*)testInputs[i]);
+            Parser parser = new_parser(testInputs[i], strlen(testInputs[i]));
 #ifdef DEBUG
-            print_token_stream(testInputs[i]);
+            print_token_stream(testInputs[i], strlen(testInputs[i]));
 #endif
             // using this so that the parse 
             parse(&parser);
             
-            analyze_semantics(parser.root);
+            if (!table) analyze_semantics(&parser.ast);
+            else if (analyze_semantics_with(&parser.ast, table) && parser.errors == 0) lower_program(&parser.ast, table);
 
             free_parser(parser);
         }
+        if (table) free_symbol_table(table);
     }
+    // symbol names and string literals stay interned until here
+    intern_free();
     return 0;
 }
@@ -0,0 +1,58 @@
+#include "parser.h"
+#include <stdlib.h>
+
+typedef struct {
+    WalkFrame frame;
+    int entered;            // pre already ran, post is due once it's on top again
+} WalkItem;
+
+/* Only the nodes the walk is in are on the stack. A node entered pushes its
+ * first child, once the child's post has run it is replaced by its next
+ * sibling, so the stack is as deep as the tree and nodes are visited in the
+ * order they are stored.
+ */
+int ast_walk(const FlatAST* ast, NodeId root, const ASTVisitor* visitor, void* ctx) {
+    if (root == NODE_NONE || root >= ast->count) return 0;
+    size_t stack_size = 64, top = 0;
+    WalkItem* stack = malloc(sizeof(WalkItem) * stack_size);
+    if (!stack) return -1;
+    stack[top++] = (WalkItem){{root, NODE_NONE, AST_SLOT_ROOT, 0}, 0};
+    int result = 0;
+
+    while (top > 0) {
+        WalkItem* item = &stack[top - 1];
+        const WalkFrame frame = item->frame;
+        if (item->entered) {
+            top--;
+            if (visitor->post) visitor->post(&frame, ctx);
+            const NodeId sibling = ast->next_sibling[frame.node];
+            if (frame.slot != AST_SLOT_ROOT && sibling != NODE_NONE) {
+                stack[top++] = (WalkItem){{sibling, frame.parent, flat_slot(ast, sibling), frame.depth}, 0};
+            }
+            continue;
+        }
+        item->entered = 1;
+
+        WalkAction action = visitor->pre ? visitor->pre(&frame, ctx) : WALK_CONTINUE;
+        if (action == WALK_STOP) {
+            result = 1;
+            break;
+        }
+        if (action == WALK_SKIP) continue;
+
+        const NodeId child = flat_first_child(ast, frame.node);
+        if (child == NODE_NONE) continue;
+        if (top == stack_size) {
+            stack_size *= 2;
+            WalkItem* grown = realloc(stack, sizeof(WalkItem) * stack_size);
+            if (!grown) {
+                result = -1;
+                break;
+            }
+            stack = grown;
+        }
+        stack[top++] = (WalkItem){{child, frame.node, flat_slot(ast, child), frame.depth + 1}, 0};
+    }
+    free(stack);
+    return result;
+}
@@ -0,0 +1,153 @@
+#include "parser.h"
+#include <stdlib.h>
+
+_Static_assert(KIND_COUNT <= 0x100, "TokenKind no longer fits FLAT_INFO");
+_Static_assert(TOKEN_NONE <= 0xf, "TokenType no longer fits FLAT_INFO");
+_Static_assert(AST_IDENTIFIER <= 0xff, "ASTType no longer fits FLAT_INFO");
+_Static_assert(TYPE_ERROR <= 0xff, "DataType no longer fits FlatAST.data_type");
+
+static int flat_grow(FlatAST* ast) {
+    uint32_t capacity = ast->capacity ? ast->capacity * 2 : 256;
+    #define GROW(field) do { \
+        void* grown = realloc(ast->field, sizeof(*ast->field) * capacity); \
+        if (!grown) return -1; \
+        ast->field = grown; \
+    } while (0)
+    GROW(info);
+    GROW(span_start);
+    GROW(span_length);
+    GROW(line);
+    GROW(next_sibling);
+    GROW(aux);
+    GROW(value);
+    GROW(data_type);
+    GROW(folded);
+    GROW(var_index);
+    #undef GROW
+    ast->capacity = capacity;
+    return 0;
+}
+
+// A node waiting to be laid out: the pointer node, the slot it hangs from
+// and the index of its parent
+typedef struct {
+    const ASTNode* node;
+    ASTSlot slot;
+    NodeId parent;
+} Pending;
+
+/* The tree is laid out in pre-order with an explicit stack, deep statement
+ * lists don't recurse. When a node is popped its own next is pushed first so
+ * it comes out after everything below the node, then body, right and left so
+ * they come out in field order. The root's next is not part of the tree.
+ * last_child keeps the latest child laid out under each parent, the next one
+ * is linked to it as its sibling.
+ */
+int flat_ast_build(FlatAST* ast, const ASTNode* root, const char* source, size_t length) {
+    memset(ast, 0, sizeof(FlatAST));
+    ast->source = source;
+    if (!root) return 0;
+
+    size_t stack_size = 64, top = 0;
+    Pending* stack = malloc(sizeof(Pending) * stack_size);
+    NodeId* last_child = NULL;
+    int result = -1;
+    if (!stack) return -1;
+    stack[top++] = (Pending){root, AST_SLOT_ROOT, NODE_NONE};
+
+    while (top > 0) {
+        Pending item = stack[--top];
+        const ASTNode* node = item.node;
+        if (ast->count == ast->capacity) {
+            if (flat_grow(ast) != 0) goto done;
+            NodeId* grown = realloc(last_child, sizeof(NodeId) * ast->capacity);
+            if (!grown) goto done;
+            last_child = grown;
+        }
+
+        NodeId id = ast->count++;
+        const Token* token = &node->current;
+        ast->info[id] = FLAT_INFO(node->type, item.slot, token->type, token->kind);
+        ast->line[id] = token->line;
+        ast->next_sibling[id] = NODE_NONE;
+        ast->aux[id] = token->id;
+        ast->value[id] = token->value;
+        ast->data_type[id] = TYPE_UNKNOWN;
+        ast->folded[id] = 0;
+        ast->var_index[id] = VAR_NONE;
+        last_child[id] = NODE_NONE;
+        if (token->start >= source && token->start + token->length <= source + length) {
+            ast->span_start[id] = (uint32_t)(token->start - source);
+            ast->span_length[id] = (uint32_t)token->length;
+        } else {
+            ast->span_start[id] = FLAT_NO_SPAN;
+            ast->span_length[id] = (uint32_t)token->length;
+            ast->aux[id] = token->length ? intern(token->start, (size_t)token->length) : INTERN_NONE;
+        }
+
+        if (item.parent != NODE_NONE) {
+            if (last_child[item.parent] == NODE_NONE) ast->info[item.parent] |= FLAT_HAS_CHILDREN;
+            else ast->next_sibling[last_child[item.parent]] = id;
+            last_child[item.parent] = id;
+        }
+
+        if (top + 4 > stack_size) {
+            stack_size *= 2;
+            Pending* grown = realloc(stack, sizeof(Pending) * stack_size);
+            if (!grown) goto done;
+            stack = grown;
+        }
+        if (node->next && item.parent != NODE_NONE) stack[top++] = (Pending){node->next, AST_SLOT_NEXT, item.parent};
+        if (node->body) stack[top++] = (Pending){node->body, AST_SLOT_BODY, id};
+        if (node->right) stack[top++] = (Pending){node->right, AST_SLOT_RIGHT, id};
+        if (node->left) stack[top++] = (Pending){node->left, AST_SLOT_LEFT, id};
+    }
+    result = 0;
+
+done:
+    free(stack);
+    free(last_child);
+    if (result != 0) flat_ast_free(ast);
+    return result;
+}
+
+void flat_ast_free(FlatAST* ast) {
+    free(ast->info);
+    free(ast->span_start);
+    free(ast->span_length);
+    free(ast->line);
+    free(ast->next_sibling);
+    free(ast->aux);
+    free(ast->value);
+    free(ast->data_type);
+    free(ast->folded);
+    free(ast->var_index);
+    memset(ast, 0, sizeof(FlatAST));
+}
+
+Token flat_ast_token(const FlatAST* ast, NodeId node) {
+    Token token;
+    memset(&token, 0, sizeof(Token));
+    uint32_t info = ast->info[node];
+    token.type = FLAT_TOKEN_TYPE(info);
+    token.kind = FLAT_TOKEN_KIND(info);
+    token.id = ast->aux[node];
+    token.line = ast->line[node];
+    token.length = (int)ast->span_length[node];
+    token.value = ast->value[node];
+    if (ast->span_start[node] != FLAT_NO_SPAN) {
+        token.start = ast->source + ast->span_start[node];
+    } else {
+        token.start = token.id != INTERN_NONE ? intern_text(token.id) : "";
+    }
+    return token;
+}
+
+// The last child of each node on the way down is the one whose subtree ends last
+NodeId flat_ast_end(const FlatAST* ast, NodeId node) {
+    for (NodeId child = flat_first_child(ast, node); child != NODE_NONE; child = flat_first_child(ast, node)) {
+        node = child;
+        while (ast->next_sibling[node] != NODE_NONE) node = ast->next_sibling[node];
+    }
+    return node + 1;
+}
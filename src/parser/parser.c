@@ -7,60 +7,71 @@
 #include <string.h>
 
 
-int str_is_in(const char* str, const char* arr[], int num) {
-    for (int i = 0; i < num; i++) {
-        if (!strcmp(str, arr[i])) {
-            return 1;
-        }
-    }
-    return 0;
-}
-
-/* get_precedence used by parse_expression */
-// idk why but this only works when inverted
-int get_precedence(const char* op) {
-    int result = 0;
-    if (str_is_in(op, UNARY, sizeof(UNARY)/sizeof(char*))) result = 1;
-    if (str_is_in(op, FACTOR, sizeof(FACTOR)/sizeof(char*))) result = 2;
-    if (str_is_in(op, ADD_SUB, sizeof(ADD_SUB)/sizeof(char*))) result = 3;
-    if (str_is_in(op, BITSHIFTS, sizeof(BITSHIFTS)/sizeof(char*))) result = 4;
-    if (str_is_in(op, COMPARISON, sizeof(COMPARISON)/sizeof(char*))) result = 5;
-    if (str_is_in(op, EQUALITY, sizeof(EQUALITY)/sizeof(char*))) result = 6;
-    if (str_is_in(op, BITAND, sizeof(BITAND)/sizeof(char*))) result = 7;
-    if (str_is_in(op, BITXOR, sizeof(BITXOR)/sizeof(char*))) result = 8;
-    if (str_is_in(op, BITOR, sizeof(BITOR)/sizeof(char*))) result = 9;
-    if (str_is_in(op, LOGAND, sizeof(LOGAND)/sizeof(char*))) result = 10;
-    if (str_is_in(op, LOGOR, sizeof(LOGOR)/sizeof(char*))) result = 11;
-    return 11 - result;
-}
+/* Binding powers used by parse_expression, indexed by kind
+ * An infix operator binds to the operand on its left with lbp and to the one
+ * on its right with rbp. Left associative levels get rbp = lbp + 1, so the
+ * same operator coming next reduces what is on the stack, right associative
+ * ones (assignment) get rbp = lbp - 1 so it stacks up instead.
+ * lbp 0 means the kind is not an infix operator and ends the expression.
+ */
+enum {
+    BP_ASSIGN = 1, BP_OR, BP_AND, BP_BITOR, BP_XOR, BP_BITAND,
+    BP_EQUALITY, BP_COMPARISON, BP_SHIFT, BP_TERM, BP_FACTOR, BP_PREFIX,
+};
+
+typedef struct {
+    unsigned char lbp;
+    unsigned char rbp;
+} BindingPower;
+
+#define LEFT(level)  { 2 * (level), 2 * (level) + 1 }
+#define RIGHT(level) { 2 * (level) + 1, 2 * (level) }
+// prefix operators only have an operand on their right
+#define PREFIX_RBP (2 * BP_PREFIX)
+
+static const BindingPower binding_power[KIND_COUNT] = {
+    [OP_MUL] = LEFT(BP_FACTOR), [OP_DIV] = LEFT(BP_FACTOR), [OP_MOD] = LEFT(BP_FACTOR),
+    [OP_ADD] = LEFT(BP_TERM), [OP_SUB] = LEFT(BP_TERM),
+    [OP_SHL] = LEFT(BP_SHIFT), [OP_SHR] = LEFT(BP_SHIFT),
+    [OP_LT] = LEFT(BP_COMPARISON), [OP_LE] = LEFT(BP_COMPARISON),
+    [OP_GT] = LEFT(BP_COMPARISON), [OP_GE] = LEFT(BP_COMPARISON),
+    [OP_EQ] = LEFT(BP_EQUALITY), [OP_NE] = LEFT(BP_EQUALITY),
+    [OP_BITAND] = LEFT(BP_BITAND),
+    [OP_XOR] = LEFT(BP_XOR),
+    [OP_BITOR] = LEFT(BP_BITOR),
+    [OP_AND] = LEFT(BP_AND),
+    [OP_OR] = LEFT(BP_OR),
+    [OP_ASSIGN ... OP_XOR_ASSIGN] = RIGHT(BP_ASSIGN),
+};
+
+#undef LEFT
+#undef RIGHT
 
 
 /*
 Some Helper Functions
 -*/
-int isKeyword(const Token t, const char *kw) {
-    return (t.type == TOKEN_KEYWORD && strcmp(t.lexeme, kw) == 0);
+int isKeyword(const Token t, TokenKind kw) {
+    return t.kind == kw;
 }
-int isOperator(const Token t, const char *op) {
-    return (t.type == TOKEN_OPERATOR && strcmp(t.lexeme, op) == 0);
+int isOperator(const Token t, TokenKind op) {
+    return t.kind == op;
 }
-int isDelimiter(const Token t, const char *delim) {
-    return (t.type == TOKEN_DELIMITER && strcmp(t.lexeme, delim) == 0);
+int isDelimiter(const Token t, TokenKind delim) {
+    return t.kind == delim;
 }
 
 void advance(Parser* parser) {
-    parser->current = parser->tokens[parser->position];
-    if (parser->current.type != TOKEN_EOF) {
-        parser->position++;
-    }
-    PARSE_INFO("advance() -> token='%s' (type=%d)\n", parser->current.lexeme, parser->current.type);
+    // once EOF is reached the stream keeps handing out EOF
+    parser->current = token_stream_next(&parser->tokens);
+    PARSE_INFO("advance() -> token='" TOKEN_FMT "' (type=%d)\n", TOKEN_ARG(parser->current), parser->current.type);
 }
 
 /* Create AST node */
-ASTNode* create_node(ASTType type, const Token* tk) {
+ASTNode* create_node(Parser* parser, ASTType type, const Token* tk) {
     const char* name = ast_type_to_string(type);
-    PARSE_INFO("create_node(type=%s, token='%s')\n", name, tk->lexeme);
-    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
+    PARSE_INFO("create_node(type=%s, token='" TOKEN_FMT "')\n", name, TOKEN_ARG(*tk));
+    ASTNode* node = (ASTNode*)arena_alloc(&parser->arena, sizeof(ASTNode));
     if(!node){
         fprintf(stderr,"No memory for ASTNode\n");
         exit(1);
@@ -70,9 +81,10 @@ ASTNode* create_node(ASTType type, const Token* tk) {
     node->left=node->right=node->next=node->body=NULL;
     return node;
 }
-ASTNode* create_node_simple(ASTType type) {
+ASTNode* create_node_simple(Parser* parser, ASTType type) {
     Token empty; memset(&empty,0,sizeof(Token));
-    return create_node(type,&empty);
+    empty.start = "";
+    return create_node(parser, type,&empty);
 }
 
 const char* ast_type_to_string(ASTType type) {
@@ -113,21 +125,29 @@ const char* ast_type_to_string(ASTType type) {
     return "UNKNOWN_AST";
 }
 
-static void print_ast_recursive(ASTNode *node, int level) {
-    if (!node) return;
-    for (int i = 0; i < level; i++) printf("  ");
-
-    switch (node->type) {
+static WalkAction print_node(const WalkFrame* frame, void* ctx) {
+    static const char* slot_label[] = {
+        [AST_SLOT_ROOT] = "",
+        [AST_SLOT_LEFT] = "left: ",
+        [AST_SLOT_RIGHT] = "right: ",
+        [AST_SLOT_BODY] = "body: ",
+        [AST_SLOT_NEXT] = "next: ",
+    };
+    const FlatAST* ast = ctx;
+    const Token token = flat_ast_token(ast, frame->node);
+    printf("%s", slot_label[frame->slot]);
+    for (int i = 0; i < frame->depth; i++) printf("  ");
+    switch (flat_type(ast, frame->node)) {
         case AST_PROGRAM:
             printf("Program\n"); break;
         case AST_BLOCK:
             printf("Block\n"); break;
         case AST_VARDECL:
-            printf("VarDecl: %s\n", node->current.lexeme); break;
+            printf("VarDecl: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_VARDECLTYPE:
-            printf("VarDeclType: %s\n", node->current.lexeme); break;
+            printf("VarDeclType: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_ASSIGN:
-            printf("Assignment: %s\n", node->current.lexeme); break;
+            printf("Assignment: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_IF:
             printf("If\n"); break;
         case AST_WHILE:
@@ -137,115 +157,71 @@ static void print_ast_recursive(ASTNode *node, int level) {
         case AST_PRINT:
             printf("Print\n"); break;
         case AST_FUNCTION_CALL:
-            printf("FunctionCall: %s\n", node->current.lexeme); break;
+            printf("FunctionCall: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_FUNCTION_ARGS:
-            printf("Function Args: %s\n", node->current.lexeme); break;
+            printf("Function Args: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_BINOP:
-            printf("BinOp: %s\n", node->current.lexeme); break;
+            printf("BinOp: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_UNARYOP:
-            printf("UnaryOp: %s\n", node->current.lexeme); break;
+            printf("UnaryOp: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_LITERAL:
-            printf("Literal: %s\n", node->current.lexeme); break;
+            printf("Literal: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         case AST_IDENTIFIER:
-            printf("Identifier: %s\n", node->current.lexeme); break;
+            printf("Identifier: " TOKEN_FMT "\n", TOKEN_ARG(token)); break;
         default:
             printf("Unknown AST Node\n"); break;
     }
-    if (node->left) {
-        printf("left: ");
-        print_ast_recursive(node->left,  level+1);
-    }
-    if (node->right) {
-        printf("right: ");
-        print_ast_recursive(node->right, level+1);
-    }
-
-    if (node->body) {
-        printf("body: ");
-        print_ast_recursive(node->body, level+1);
-    }
-    if(node->next){
-        printf("next: ");
-        print_ast_recursive(node->next,level);
-    }
+    return WALK_CONTINUE;
 }
-void print_ast(ASTNode* root){
-    print_ast_recursive(root,0);
+
+// The walk's order is the printed one: children one level deeper in field
+// order, a next list at the depth of its head
+void print_ast(const FlatAST* ast) {
+    static const ASTVisitor printer = { print_node, NULL };
+    if (ast_walk(ast, 0, &printer, (void*)ast) < 0) fprintf(stderr, "No memory to print the AST\n");
 }
 
 /* Build Token Table */
-Token* make_table(char* in){
+// Lexes the whole input into one EOF-terminated table, the parser itself pulls
+// tokens lazily through a TokenStream and doesn't need this
+Token* make_table(const char* in, size_t length){
     PARSE_INFO("make_table()\n");
-    Token* table = malloc(sizeof(Token) * MAX_TABLE_SIZE);
-    TokenType last = TOKEN_NONE;
-    Token current;
-    int position = 0;
-    int lexemmes = 0;
-
-    do {
-        current = get_next_token(in, &position, last);
-        if (current.error != ERROR_NONE) {
-            print_error(current.error, current.line, current.lexeme);
-            //free(table);
-            //fprintf(stderr, "Failed to create token table\n");
-            //return NULL;
-        }
-        last = current.type;
-        table[lexemmes++] = current;
-    } while (current.type != TOKEN_EOF);
-
-    Token* new_table = malloc(sizeof(Token) * (lexemmes + 1));
-    memcpy(new_table, table, sizeof(Token) * (lexemmes + 1));
-    free(table);
-    PARSE_INFO("make_table -> generated %d tokens\n",lexemmes);
-    return new_table;
-}
+    size_t lexemmes = 0;
+    Token* table = lex_table(in, length, &lexemmes);
+    if (!table) return NULL;
 
-/* parse_factorial if keyword is "factorial(...)" */
-ASTNode* parse_factorial(Parser* parser){
-    ASTNode* fact = create_node(AST_FACTORIAL,&parser->current);
-    advance(parser); // skip "factorial"
-    if(!isDelimiter(parser->current, "(")) {
-        PARSE_ERROR(parser, EXPECTED, "'(' after factorial");
-    }
-    advance(parser);
-    ASTNode* expr=parse_expression(parser, 0);
-    if(!isDelimiter(parser->current,")")){
-        PARSE_ERROR(parser, EXPECTED, "'(' after expression");
+    for (size_t i = 0; i < lexemmes; i++) {
+        if (table[i].error != ERROR_NONE) {
+            print_error(table[i]);
+        }
     }
-    advance(parser);
-    fact->left = expr;
-    return fact;
+    PARSE_INFO("make_table -> generated %zu tokens\n", lexemmes);
+    return table;
 }
 
-/* parse_primary: numbers, strings, ids, parentheses, function calls, factorial. */
+/* parse_primary: numbers, strings, ids, parentheses, function calls. */
 ASTNode* parse_primary(Parser* parser) {
-    PARSE_INFO("parse_primary -> current='%s'\n", parser->current.lexeme);
-
-    // check factorial
-    if(parser->current.type==TOKEN_KEYWORD && !strcmp(parser->current.lexeme, "factorial")){
-        return parse_factorial(parser);
-    }
+    PARSE_INFO("parse_primary -> current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
 
-    if (isDelimiter(parser->current, "(")) {
+    if (isDelimiter(parser->current, DELIM_LPAREN)) {
         PARSE_INFO("parse_primary -> '(' found\n");
         advance(parser);
         ASTNode* expr = parse_expression(parser, 0);
-        if (!isDelimiter(parser->current, ")")) {
+        if (!isDelimiter(parser->current, DELIM_RPAREN)) {
             PARSE_ERROR(parser, EXPECTED_DELIMITER, "')' to match '('")
         }
         advance(parser); // consume ")"
         return expr;
     }
-    if (parser->current.type == TOKEN_NUMBER) {
-        PARSE_INFO("parse_primary -> NUMBER '%s'\n", parser->current.lexeme);
-        ASTNode* node = create_node(AST_LITERAL, &parser->current);
+    if (parser->current.type == TOKEN_NUMBER || parser->current.type == TOKEN_FLOAT) {
+        PARSE_INFO("parse_primary -> NUMBER '" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
+        ASTNode* node = create_node(parser, AST_LITERAL, &parser->current);
         advance(parser);
         return node;
     }
     if (parser->current.type == TOKEN_STRING) {
-        PARSE_INFO("parse_primary -> STRING '%s'\n", parser->current.lexeme);
-        ASTNode* node = create_node(AST_LITERAL, &parser->current);
+        PARSE_INFO("parse_primary -> STRING '" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
+        ASTNode* node = create_node(parser, AST_LITERAL, &parser->current);
         advance(parser);
         return node;
     }
@@ -254,15 +230,15 @@ ASTNode* parse_primary(Parser* parser) {
         Token id = parser->current;
         advance(parser);
         if (id.type == parser->current.type) {
-            PARSE_ERROR(parser, UNEXPECTED, "Back to back identifiers %s", id.lexeme);
+            PARSE_ERROR(parser, UNEXPECTED, "Back to back identifiers " TOKEN_FMT, TOKEN_ARG(id));
         }
-        if (isDelimiter(parser->current, "(")) {
+        if (isDelimiter(parser->current, DELIM_LPAREN)) {
             PARSE_INFO("parse_primary -> function call\n");
-            ASTNode* callNode = create_node(AST_FUNCTION_CALL, &id);
+            ASTNode* callNode = create_node(parser, AST_FUNCTION_CALL, &id);
             advance(parser); // consume "("
             ASTNode* argHead = NULL;
             ASTNode* argTail = NULL;
-            while (!isDelimiter(parser->current, ")") && parser->current.type != TOKEN_EOF) {
+            while (!isDelimiter(parser->current, DELIM_RPAREN) && parser->current.type != TOKEN_EOF) {
                 ASTNode* arg = parse_expression(parser, 0);
 
                 if (arg == NULL) {
@@ -274,13 +250,13 @@ ASTNode* parse_primary(Parser* parser) {
                 else          argTail->next = arg;
                 argTail = arg;
 
-                if (isDelimiter(parser->current, ",")) {
+                if (isDelimiter(parser->current, DELIM_COMMA)) {
                     advance(parser); // consume comma
                 } else {
                     break;
                 }
             }
-            if (!isDelimiter(parser->current, ")")) {
+            if (!isDelimiter(parser->current, DELIM_RPAREN)) {
                 PARSE_ERROR(parser, EXPECTED_DELIMITER, "')' in function call")
             }
             advance(parser);
@@ -288,8 +264,8 @@ ASTNode* parse_primary(Parser* parser) {
             return callNode;
         } else {
             // plain identifier
-            PARSE_INFO("parse_primary->identifier '%s'\n", id.lexeme);
-            ASTNode* idNode=create_node(AST_IDENTIFIER,&id);
+            PARSE_INFO("parse_primary->identifier '" TOKEN_FMT "'\n", TOKEN_ARG(id));
+            ASTNode* idNode=create_node(parser, AST_IDENTIFIER,&id);
             return idNode;
         }
     }
@@ -299,26 +275,86 @@ ASTNode* parse_primary(Parser* parser) {
     return NULL;
 }
 
-// Parse expression based on operator precedence
-ASTNode* parse_expression(Parser* parser, int min_precedence) {
-    PARSE_INFO("parse_expression -> start, current='%s'\n", parser->current.lexeme);
-    ASTNode* left = parse_primary(parser);
+static void push_operand(Parser* parser, ASTNode* node) {
+    ExprStack* stack = &parser->expr;
+    if (stack->operand_count == stack->operand_capacity) {
+        size_t capacity = stack->operand_capacity ? stack->operand_capacity * 2 : 64;
+        ASTNode** grown = realloc(stack->operands, sizeof(ASTNode*) * capacity);
+        if (!grown) {
+            fprintf(stderr,"No memory for the expression stack\n");
+            exit(1);
+        }
+        stack->operands = grown;
+        stack->operand_capacity = capacity;
+    }
+    stack->operands[stack->operand_count++] = node;
+}
+
+static void push_operator(Parser* parser, const Token op, int rbp, int prefix) {
+    ExprStack* stack = &parser->expr;
+    if (stack->operator_count == stack->operator_capacity) {
+        size_t capacity = stack->operator_capacity ? stack->operator_capacity * 2 : 64;
+        PendingOp* grown = realloc(stack->operators, sizeof(PendingOp) * capacity);
+        if (!grown) {
+            fprintf(stderr,"No memory for the expression stack\n");
+            exit(1);
+        }
+        stack->operators = grown;
+        stack->operator_capacity = capacity;
+    }
+    stack->operators[stack->operator_count++] = (PendingOp){op, (unsigned char)rbp, (unsigned char)prefix};
+}
+
+// Pops the top operator with its operands and pushes the node built from them
+static void reduce(Parser* parser) {
+    ExprStack* stack = &parser->expr;
+    PendingOp top = stack->operators[--stack->operator_count];
+    ASTNode* node;
+    if (top.prefix) {
+        node = create_node(parser, AST_UNARYOP, &top.op);
+        node->right = stack->operands[--stack->operand_count];
+    } else {
+        node = create_node(parser, IS_ASSIGN_KIND(top.op.kind) ? AST_ASSIGN : AST_BINOP, &top.op);
+        node->right = stack->operands[--stack->operand_count];
+        node->left = stack->operands[--stack->operand_count];
+    }
+    push_operand(parser, node);
+}
 
-    while (parser->current.type == TOKEN_OPERATOR) {
-        Token op = parser->current; 
-        int prec = get_precedence(parser->current.lexeme);
-        if (prec < min_precedence) {
-            break;
+/* parse_expression: Pratt parser without recursion per operator
+ * Prefix operators are stacked until the operand they apply to, then each
+ * infix operator first reduces everything on the stack that binds tighter
+ * than it does, so the stacks never hold more than one chain of increasing
+ * binding power. Only parentheses and call arguments recurse.
+ * Stops at the first operator with lbp below min_bp.
+ */
+ASTNode* parse_expression(Parser* parser, int min_bp) {
+    PARSE_INFO("parse_expression -> start, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
+    ExprStack* stack = &parser->expr;
+    const size_t operator_base = stack->operator_count;
+
+    for (;;) {
+        while (parser->current.type == TOKEN_OPERATOR && IS_PREFIX_KIND(parser->current.kind)) {
+            push_operator(parser, parser->current, PREFIX_RBP, 1);
+            advance(parser);
+        }
+        push_operand(parser, parse_primary(parser));
+
+        if (parser->current.type != TOKEN_OPERATOR) break;
+        const BindingPower bp = binding_power[parser->current.kind];
+        if (bp.lbp == 0 || bp.lbp < min_bp) break;
+        while (stack->operator_count > operator_base &&
+               bp.lbp < stack->operators[stack->operator_count - 1].rbp) {
+            reduce(parser);
         }
+        push_operator(parser, parser->current, bp.rbp, 0);
         advance(parser);
-        ASTNode* right = parse_expression(parser, prec + 1);
-        ASTNode* binNode = create_node(AST_BINOP, &op);
-        binNode->left = left;
-        binNode->right = right;
-        left = binNode;
-    }
-    PARSE_INFO("parse_expression -> end %s\n", parser->current.lexeme);
-    return left;
+    }
+    while (stack->operator_count > operator_base) {
+        reduce(parser);
+    }
+    PARSE_INFO("parse_expression -> end " TOKEN_FMT "\n", TOKEN_ARG(parser->current));
+    return stack->operands[--stack->operand_count];
 }
 
 /*
@@ -327,25 +363,32 @@ ASTNode* parse_expression(Parser* parser, int min_precedence) {
 
 // parse_block: "{" { ... } "}"
 ASTNode* parse_block(Parser* parser) {
-    PARSE_INFO("parse_block -> start, current='%s'\n", parser->current.lexeme);
-    if (!isDelimiter(parser->current, "{")) {
+    PARSE_INFO("parse_block -> start, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
+    if (!isDelimiter(parser->current, DELIM_LBRACE)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "{ in block");
     }
     Token braceTok = parser->current;
     advance(parser); // consume "{"
 
-    ASTNode* blockNode = create_node(AST_BLOCK, &braceTok);
+    ASTNode* blockNode = create_node(parser, AST_BLOCK, &braceTok);
     ASTNode* head = NULL;
     ASTNode* tail = NULL;
-    while (!isDelimiter(parser->current, "}") && parser->current.type != TOKEN_EOF) {
-        PARSE_INFO("parse_block -> reading stmt, current='%s'\n", parser->current.lexeme);
+    while (!isDelimiter(parser->current, DELIM_RBRACE) && parser->current.type != TOKEN_EOF) {
+        PARSE_INFO("parse_block -> reading stmt, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
         ASTNode* stmt = NULL;
 
-        if (CONTAINS_STR(TYPES, parser->current.lexeme)) {
-            printf("here\n");
-            stmt = parse_declaration(parser);
-        } else {
-            stmt = parse_statement(parser);
+        switch (parser->current.kind) {
+            case KW_INT:
+            case KW_UINT:
+            case KW_FLOAT:
+            case KW_STRING:
+            case KW_CHAR:
+                printf("here\n");
+                stmt = parse_declaration(parser);
+                break;
+            default:
+                stmt = parse_statement(parser);
+                break;
         }
         if (stmt == NULL) {
             PARSE_ERROR(parser, EXPECTED, "statement or declaration, found invalid");
@@ -364,13 +407,13 @@ ASTNode* parse_block(Parser* parser) {
         }
     }
 
-    if (!isDelimiter(parser->current, "}")) {
+    if (!isDelimiter(parser->current, DELIM_RBRACE)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "'}' to match '{' in a block");
     }
     advance(parser); // consume "}"
 
     // If you get a ;, just consume it to ignore it
-    if (isDelimiter(parser->current, ";")) {
+    if (isDelimiter(parser->current, DELIM_SEMICOLON)) {
         advance(parser); // consume ";"
     }
     parser->scope_level--;
@@ -380,28 +423,28 @@ ASTNode* parse_block(Parser* parser) {
 }
 
 ASTNode* parse_if_statement(Parser* parser) {
-    PARSE_INFO("parse_if_statement -> start, current='%s'\n", parser->current.lexeme);
+    PARSE_INFO("parse_if_statement -> start, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
     Token ifTok = parser->current; 
     advance(parser); // consume "if"
 
-    if (!isDelimiter(parser->current, "(")) {
+    if (!isDelimiter(parser->current, DELIM_LPAREN)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "( after if");
     }
     advance(parser); // consume "("
 
     ASTNode* cond = parse_expression(parser, 0);
 
-    if (!isDelimiter(parser->current, ")")) {
+    if (!isDelimiter(parser->current, DELIM_RPAREN)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, ") after if condition");
     }
     advance(parser); // consume ")"
 
-    ASTNode* ifNode = create_node(AST_IF, &ifTok);
+    ASTNode* ifNode = create_node(parser, AST_IF, &ifTok);
     ASTNode* thenBlock = parse_block(parser);
     ifNode->left  = cond;
     ifNode->right = thenBlock;
 
-    if (isKeyword(parser->current, "else")) {
+    if (isKeyword(parser->current, KW_ELSE)) {
         PARSE_INFO("parse_if_statement -> found 'else'\n");
         advance(parser); // consume "else"
         ASTNode* elseBlock = parse_block(parser);
@@ -416,19 +459,19 @@ ASTNode* parse_while_statement(Parser* parser) {
     Token whTok = parser->current;
     advance(parser); // consume "while"
 
-    if (!isDelimiter(parser->current, "(")) {
+    if (!isDelimiter(parser->current, DELIM_LPAREN)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "( after while");
     }
     advance(parser); // consume "("
 
     ASTNode* cond = parse_expression(parser, 0);
 
-    if (!isDelimiter(parser->current, ")")) {
+    if (!isDelimiter(parser->current, DELIM_RPAREN)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, ") after while condition");
     }
     advance(parser); // consume ")"
 
-    ASTNode* whNode = create_node(AST_WHILE, &whTok);
+    ASTNode* whNode = create_node(parser, AST_WHILE, &whTok);
     ASTNode* bodyBlock = parse_block(parser);
     whNode->left  = cond;
     whNode->right = bodyBlock;
@@ -443,24 +486,24 @@ ASTNode* parse_repeat_until(Parser* parser) {
 
     ASTNode* blockNode = parse_block(parser);
 
-    if (!isKeyword(parser->current, "until")) {
+    if (!isKeyword(parser->current, KW_UNTIL)) {
         PARSE_ERROR(parser, EXPECTED, "'until' after 'repeat'");
     }
     advance(parser); // consume "until"
 
-    if (!isDelimiter(parser->current, "(")) {
+    if (!isDelimiter(parser->current, DELIM_LPAREN)) {
         PARSE_ERROR(parser, EXPECTED, "'(' after 'until'");
     }
     advance(parser); // consume "("
 
     ASTNode* cond = parse_expression(parser, 0);
 
-    if (!isDelimiter(parser->current, ")")) {
+    if (!isDelimiter(parser->current, DELIM_RPAREN)) {
         PARSE_ERROR(parser, EXPECTED, "')' after 'until' condition")
     }
     advance(parser); // consume ")"
 
-    ASTNode* rptNode = create_node(AST_REPEAT, &rptTok);
+    ASTNode* rptNode = create_node(parser, AST_REPEAT, &rptTok);
     rptNode->left  = blockNode;
     rptNode->right = cond;
     PARSE_INFO("parse_repeat_until -> end\n");
@@ -472,11 +515,11 @@ ASTNode* parse_print_statement(Parser* parser) {
     Token prTok = parser->current;
     advance(parser); // consume "print"
 
-    ASTNode* prNode = create_node(AST_PRINT, &prTok);
+    ASTNode* prNode = create_node(parser, AST_PRINT, &prTok);
     ASTNode* expr = parse_expression(parser, 0);
     prNode->right = expr;
 
-    if (!isDelimiter(parser->current, ";")) {
+    if (!isDelimiter(parser->current, DELIM_SEMICOLON)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "; after print");
     }
     advance(parser); // consume ";"
@@ -485,19 +528,22 @@ ASTNode* parse_print_statement(Parser* parser) {
 }
 
 ASTNode* parse_statement(Parser* parser) {
-    PARSE_INFO("parse_statement -> start, current='%s'\n", parser->current.lexeme);
+    PARSE_INFO("parse_statement -> start, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
 
-    if (isKeyword(parser->current, "if"))      return parse_if_statement(parser);
-    if (isKeyword(parser->current, "while"))   return parse_while_statement(parser);
-    if (isKeyword(parser->current, "repeat"))  return parse_repeat_until(parser);
-    if (isKeyword(parser->current, "print"))   return parse_print_statement(parser);
-    if (isDelimiter(parser->current, "{"))     return parse_block(parser);
+    switch (parser->current.kind) {
+        case KW_IF:         return parse_if_statement(parser);
+        case KW_WHILE:      return parse_while_statement(parser);
+        case KW_REPEAT:     return parse_repeat_until(parser);
+        case KW_PRINT:      return parse_print_statement(parser);
+        case DELIM_LBRACE:  return parse_block(parser);
+        default:            break;
+    }
     ASTNode* statement = NULL;
     if (parser->current.type == TOKEN_IDENTIFIER) {
         // Peek next token
-        Token nextTok = parser->tokens[parser->position];
-        if (CONTAINS_STR(ASSIGNMENTS, nextTok.lexeme)) {
-            ASTNode* lhs = create_node(AST_IDENTIFIER, &parser->current);
+        Token nextTok = token_stream_peek(&parser->tokens, 0);
+        if (IS_ASSIGN_KIND(nextTok.kind)) {
+            ASTNode* lhs = create_node(parser, AST_IDENTIFIER, &parser->current);
             advance(parser);
             statement = parse_assignment(parser, lhs);
         } else {
@@ -507,7 +553,7 @@ ASTNode* parse_statement(Parser* parser) {
         }
     }
     // If you get a ;, just consume it to ignore it
-    if (isDelimiter(parser->current, ";")) {
+    if (isDelimiter(parser->current, DELIM_SEMICOLON)) {
         advance(parser); // consume ";"
     } else {
         //PARSE_ERROR(parser, EXPECTED_DELIMITER, "; after statement");
@@ -522,35 +568,35 @@ ASTNode* parse_statement(Parser* parser) {
 ASTNode* parse_function_args(Parser* parser) {
     PARSE_INFO("parse_function_args -> start\n");
     ASTNode* func_args = NULL;
-    if (isDelimiter(parser->current, ")")) {
+    if (isDelimiter(parser->current, DELIM_RPAREN)) {
         advance(parser);
         return NULL;
     }
     while (1) {
-        if (!CONTAINS_STR(TYPES, parser->current.lexeme)) PARSE_ERROR_S(parser, EXPECTED_TYPE_IN_FUNC_DECL);
+        if (!IS_TYPE_KIND(parser->current.kind)) PARSE_ERROR_S(parser, EXPECTED_TYPE_IN_FUNC_DECL);
         Token type = parser->current;
         // Could be strict here to make semantics easier
         // Or lax, making parser easier but semantics harder
-        ASTNode* arg_type = create_node(AST_VARDECLTYPE, &parser->current);
+        ASTNode* arg_type = create_node(parser, AST_VARDECLTYPE, &parser->current);
         
         if (func_args == NULL) func_args = arg_type;
         advance(parser);
-        if (parser->current.type != TOKEN_IDENTIFIER) PARSE_ERROR(parser, EXPECTED_IDENTIFIER, "with type %s", type.lexeme);
+        if (parser->current.type != TOKEN_IDENTIFIER) PARSE_ERROR(parser, EXPECTED_IDENTIFIER, "with type " TOKEN_FMT, TOKEN_ARG(type));
         
-        arg_type->body = create_node(AST_VARDECL, &parser->current);
+        arg_type->body = create_node(parser, AST_VARDECL, &parser->current);
         if (arg_type != func_args) func_args->next = arg_type;
         
         advance(parser);
-        if (!isDelimiter(parser->current, ",")) break;
+        if (!isDelimiter(parser->current, DELIM_COMMA)) break;
         advance(parser);
     }
-    if (!isDelimiter(parser->current, ")")) {
+    if (!isDelimiter(parser->current, DELIM_RPAREN)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, ") after function args")
     }
     advance(parser);
 
     // Now get the body of the function
-    if (!isDelimiter(parser->current, "{")) {
+    if (!isDelimiter(parser->current, DELIM_LBRACE)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "{ after function declaration")
     }
 
@@ -560,35 +606,35 @@ ASTNode* parse_function_args(Parser* parser) {
 // parse_declaration: "int x"
 ASTNode* parse_declaration(Parser* parser) {
     PARSE_INFO("parse_declaration -> start\n");
-    if (parser->current.type != TOKEN_KEYWORD && !CONTAINS_STR(TYPES, parser->current.lexeme)) {
+    if (!IS_TYPE_KIND(parser->current.kind)) {
         PARSE_ERROR(parser, EXPECTED_TYPE, "in declaration");
     }
-    ASTNode* declNode = create_node(AST_VARDECLTYPE, &parser->current);
+    ASTNode* declNode = create_node(parser, AST_VARDECLTYPE, &parser->current);
     advance(parser);
 
     if (parser->current.type != TOKEN_IDENTIFIER) {
-        PARSE_ERROR(parser, EXPECTED_IDENTIFIER, "in declaration after type %s", declNode->current.lexeme);
+        PARSE_ERROR(parser, EXPECTED_IDENTIFIER, "in declaration after type " TOKEN_FMT, TOKEN_ARG(declNode->current));
     }
-    ASTNode* lhs = create_node(AST_VARDECL, &parser->current);
+    ASTNode* lhs = create_node(parser, AST_VARDECL, &parser->current);
     advance(parser);
 
     // Parse assignment to an identifier after a declaration
-    if (CONTAINS_STR(ASSIGNMENTS, parser->current.lexeme)) {
-        PARSE_INFO("parse_declaration assignment -> found '%s'\n", parser->current.lexeme);
+    if (IS_ASSIGN_KIND(parser->current.kind)) {
+        PARSE_INFO("parse_declaration assignment -> found '" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
         ASTNode* assignmnent = parse_assignment(parser, lhs);
         declNode->body = assignmnent;
-        if (isDelimiter(parser->current, ";")) {
+        if (isDelimiter(parser->current, DELIM_SEMICOLON)) {
             advance(parser); // consume ';'
-        } else if (isDelimiter(parser->current, "}")) {
+        } else if (isDelimiter(parser->current, DELIM_RBRACE)) {
         }
-    } else if (isDelimiter(parser->current, "(")) { // Function declaration, parse the 
-        PARSE_INFO("parse_decl function %s\n", parser->current.lexeme);
+    } else if (isDelimiter(parser->current, DELIM_LPAREN)) { // Function declaration, parse the 
+        PARSE_INFO("parse_decl function " TOKEN_FMT "\n", TOKEN_ARG(parser->current));
         advance(parser);
         ASTNode* func_args = parse_function_args(parser);
         lhs->right = func_args;
         lhs->body = parse_block(parser);
         declNode->body = lhs;
-    } else if (isDelimiter(parser->current, ";")) {
+    } else if (isDelimiter(parser->current, DELIM_SEMICOLON)) {
         declNode->body = lhs;
         advance(parser);
     }
@@ -599,16 +645,16 @@ ASTNode* parse_declaration(Parser* parser) {
 // parse_assignment: "x = expr;"
 ASTNode* parse_assignment(Parser* parser, ASTNode* lhs) {
     PARSE_INFO("parse_assignment -> start\n");
-    if (!CONTAINS_STR(ASSIGNMENTS, parser->current.lexeme)) {
+    if (!IS_ASSIGN_KIND(parser->current.kind)) {
         PARSE_ERROR(parser, EXPECTED_ASSIGNMENT, "}");
     }
-    ASTNode* assignNode = create_node(AST_ASSIGN, &parser->current);
+    ASTNode* assignNode = create_node(parser, AST_ASSIGN, &parser->current);
     advance(parser); // consume operator
     ASTNode* rhs = parse_expression(parser, 0);
     assignNode->right = rhs;
     assignNode->left = lhs;
 
-    if (!isDelimiter(parser->current, ";")) {
+    if (!isDelimiter(parser->current, DELIM_SEMICOLON)) {
         PARSE_ERROR(parser, EXPECTED_DELIMITER, "; after assignment");
     }
     advance(parser); // consume ";"
@@ -623,19 +669,30 @@ ASTNode* parse_program(Parser* parser) {
     PARSE_INFO("parse_program -> start\n");
     Token dummy;
     memset(&dummy, 0, sizeof(Token));
-    ASTNode* programNode = create_node(AST_PROGRAM, &dummy);
+    dummy.start = "";
+    ASTNode* programNode = create_node(parser, AST_PROGRAM, &dummy);
     ASTNode* head = NULL;
     ASTNode* tail = NULL;
 
     while (parser->current.type != TOKEN_EOF) {
-        PARSE_INFO("parse_program -> reading top-level, current='%s'\n", parser->current.lexeme);
+        PARSE_INFO("parse_program -> reading top-level, current='" TOKEN_FMT "'\n", TOKEN_ARG(parser->current));
         ASTNode* node = NULL;
-        if (str_is_in(parser->current.lexeme, TYPES, sizeof(TYPES)/sizeof(char*))) {
-            node = parse_declaration(parser);
-        } else if (str_is_in(parser->current.lexeme, KEYWORDS, sizeof(KEYWORDS)/sizeof(char*))){
-            node = parse_statement(parser);
-        } else {
-            node = parse_statement(parser);
+        switch (parser->current.kind) {
+            case KW_INT:
+            case KW_UINT:
+            case KW_FLOAT:
+            case KW_STRING:
+            case KW_CHAR:
+                node = parse_declaration(parser);
+                break;
+            default:
+                node = parse_statement(parser);
+                break;
+        }
+        if (node == NULL) {
+            PARSE_ERROR(parser, EXPECTED, "statement or declaration, found invalid");
+            advance(parser);
+            continue;
         }
         if (!head) { head = node; } else { tail->next = node; }
         tail = node;
@@ -648,14 +705,11 @@ ASTNode* parse_program(Parser* parser) {
 }
 
 
-Parser new_parser(char *input) {
+Parser new_parser(const char *input, size_t length) {
     Parser parser = {};
     memset(&parser, 0, sizeof(Parser));
-    parser.tokens = make_table(input);
-    if (parser.tokens == NULL) {
-        fprintf(stderr, "Failed to create token table\n");
-        exit(0);
-    }
+    token_stream_init(&parser.tokens, input, length);
+    arena_init(&parser.arena, ARENA_BLOCK_SIZE);
     return parser;
 }
 
@@ -664,13 +718,27 @@ int parse(Parser* parser) {
     advance(parser); 
 
     parser->root = parse_program(parser);
+    // the passes after this one only see the flat layout
+    const Lexer* lexer = &parser->tokens.lexer;
+    if (flat_ast_build(&parser->ast, parser->root, lexer->input, lexer->length) != 0) {
+        fprintf(stderr,"No memory for the flat AST\n");
+        exit(1);
+    }
+    arena_free(&parser->arena);
+    parser->root = NULL;
     PARSE_INFO("\n--- PARSED AST ---\n");
-    print_ast(parser->root);
+    print_ast(&parser->ast);
 
     PARSE_INFO("parse -> end\n");
     return 0;
 }
 
 void free_parser(Parser parser) {
-    free(parser.tokens);
+    // tokens point into the source buffer, only a pre-lexed table is owned
+    token_stream_free(&parser.tokens);
+    // whatever is left of the pointer tree goes with the arena
+    arena_free(&parser.arena);
+    flat_ast_free(&parser.ast);
+    free(parser.expr.operands);
+    free(parser.expr.operators);
 }
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "fold.h"
+#include "semantic.h"
+
+static void* grow(void* array, int* capacity, int needed, size_t size) {
+    if (needed <= *capacity) return array;
+    int grown_capacity = *capacity ? *capacity : 64;
+    while (grown_capacity < needed) grown_capacity *= 2;
+    void* grown = realloc(array, size * grown_capacity);
+    if (!grown) {
+        fprintf(stderr, "No memory for the semantic checker\n");
+        exit(1);
+    }
+    *capacity = grown_capacity;
+    return grown;
+}
+
+/*
+
+Known values
+
+*/
+
+static int is_known(const Constants* constants, int var) {
+    return var >= 0 && var < constants->capacity && constants->epoch != 0 && constants->known[var] == constants->epoch;
+}
+
+static void set_value(Constants* constants, int var, TokenValue value) {
+    if (var >= constants->capacity) {
+        const int old_capacity = constants->capacity;
+        int capacity = old_capacity;
+        constants->values = grow(constants->values, &capacity, var + 1, sizeof(TokenValue));
+        constants->known = grow(constants->known, &constants->capacity, var + 1, sizeof(uint64_t));
+        memset(constants->known + old_capacity, 0, sizeof(uint64_t) * (constants->capacity - old_capacity));
+    }
+    if (constants->epoch == 0) constants->epoch = ++constants->last_epoch;
+    constants->values[var] = value;
+    constants->known[var] = constants->epoch;
+    if (constants->mark_count > 0) {
+        constants->written = grow(constants->written, &constants->written_capacity, constants->written_count + 1, sizeof(int));
+        constants->written[constants->written_count++] = var;
+    }
+}
+
+static void forget(Constants* constants, int var) {
+    if (var >= 0 && var < constants->capacity) constants->known[var] = 0;
+}
+
+static void forget_all(Constants* constants) {
+    constants->epoch = ++constants->last_epoch;
+}
+
+static void open_scope(Constants* constants) {
+    FoldScope scope = { constants->epoch, constants->calls };
+    constants->scopes = grow(constants->scopes, &constants->scope_capacity, constants->scope_count + 1, sizeof(FoldScope));
+    constants->scopes[constants->scope_count++] = scope;
+    forget_all(constants);
+}
+
+// A function body doesn't run where it is declared, nothing it did counts
+static void close_scope(Constants* constants, int is_function) {
+    if (constants->scope_count == 0) return;
+    const FoldScope scope = constants->scopes[--constants->scope_count];
+    if (is_function) constants->calls = scope.calls;
+    if (constants->calls == scope.calls) constants->epoch = scope.epoch;
+    else forget_all(constants);
+}
+
+// Forgets what the branch of the innermost if set
+static void end_branch(Constants* constants) {
+    if (constants->mark_count == 0) return;
+    for (int i = constants->marks[constants->mark_count - 1]; i < constants->written_count; i++) {
+        forget(constants, constants->written[i]);
+    }
+}
+
+/*
+
+Folding
+
+*/
+
+typedef struct {
+    DataType type;
+    TokenValue value;
+} Constant;
+
+static int is_number(DataType type) {
+    return type == TYPE_INT || type == TYPE_UINT || type == TYPE_FLOAT;
+}
+
+static int literal_value(const FlatAST* ast, NodeId node, Constant* constant) {
+    if (node == NODE_NONE || folded_type(ast, node) != AST_LITERAL || !is_number(ast->data_type[node])) return 0;
+    if (!ast->folded[node]) {
+        const TokenType type = FLAT_TOKEN_TYPE(ast->info[node]);
+        if (type != TOKEN_NUMBER && type != TOKEN_FLOAT) return 0;
+    }
+    constant->type = ast->data_type[node];
+    constant->value = ast->value[node];
+    return 1;
+}
+
+static double as_float(Constant constant) {
+    if (constant.type == TYPE_FLOAT) return constant.value.f;
+    if (constant.type == TYPE_UINT) return (double)constant.value.u;
+    return (double)(long long)constant.value.u;
+}
+
+// Fails for floats out of the integer's range
+static int convert_constant(Constant* constant, DataType to) {
+    if ((constant->type == TYPE_FLOAT) == (to == TYPE_FLOAT)) {
+        constant->type = to;
+        return 1;
+    }
+    if (to == TYPE_FLOAT) {
+        constant->value.f = as_float(*constant);
+    } else {
+        const double f = constant->value.f;
+        if (to == TYPE_UINT && f > -1.0 && f < 18446744073709551616.0) constant->value.u = (unsigned long long)f;
+        else if (to == TYPE_INT && f >= -9223372036854775808.0 && f < 9223372036854775808.0) constant->value.u = (unsigned long long)(long long)f;
+        else return 0;
+    }
+    constant->type = to;
+    return 1;
+}
+
+static int truth(Constant* result, int value) {
+    result->type = TYPE_INT;
+    result->value.u = value != 0;
+    return 1;
+}
+
+static int is_comparison(TokenKind op) {
+    return op == OP_LT || op == OP_GT || op == OP_LE || op == OP_GE ||
+           op == OP_EQ || op == OP_NE || op == OP_AND || op == OP_OR;
+}
+
+// Mixed integer and float operands are computed in float, integers wrap.
+// Returns 0 if the operation can't be folded (division by zero, overflowing
+// division, shift by the width or more)
+static int fold_binary(TokenKind op, Constant left, Constant right, DataType type, Constant* result) {
+    if (!is_number(type)) return 0;
+    if (left.type == TYPE_FLOAT || right.type == TYPE_FLOAT) {
+        const double a = as_float(left);
+        const double b = as_float(right);
+        double f;
+        switch (op) {
+            case OP_ADD: f = a + b; break;
+            case OP_SUB: f = a - b; break;
+            case OP_MUL: f = a * b; break;
+            case OP_DIV:
+                if (b == 0) return 0;
+                f = a / b;
+                break;
+            case OP_LT: return truth(result, a < b);
+            case OP_GT: return truth(result, a > b);
+            case OP_LE: return truth(result, a <= b);
+            case OP_GE: return truth(result, a >= b);
+            case OP_EQ: return truth(result, a == b);
+            case OP_NE: return truth(result, a != b);
+            case OP_AND: return truth(result, a != 0 && b != 0);
+            case OP_OR: return truth(result, a != 0 || b != 0);
+            default: return 0;
+        }
+        if (type != TYPE_FLOAT) return 0;
+        result->type = TYPE_FLOAT;
+        result->value.f = f;
+        return 1;
+    }
+
+    const unsigned long long a = left.value.u;
+    const unsigned long long b = right.value.u;
+    const long long sa = (long long)a;
+    const long long sb = (long long)b;
+    const int is_unsigned = left.type == TYPE_UINT || right.type == TYPE_UINT;
+    unsigned long long u;
+    switch (op) {
+        case OP_ADD: u = a + b; break;
+        case OP_SUB: u = a - b; break;
+        case OP_MUL: u = a * b; break;
+        case OP_DIV:
+        case OP_MOD:
+            if (b == 0 || (!is_unsigned && sa == LLONG_MIN && sb == -1)) return 0;
+            if (is_unsigned) u = op == OP_DIV ? a / b : a % b;
+            else u = (unsigned long long)(op == OP_DIV ? sa / sb : sa % sb);
+            break;
+        case OP_SHL:
+            if (b >= 64) return 0;
+            u = a << b;
+            break;
+        case OP_SHR:
+            if (b >= 64) return 0;
+            u = is_unsigned ? a >> b : (unsigned long long)(sa >> b);
+            break;
+        case OP_BITAND: u = a & b; break;
+        case OP_BITOR: u = a | b; break;
+        case OP_XOR: u = a ^ b; break;
+        case OP_LT: return truth(result, is_unsigned ? a < b : sa < sb);
+        case OP_GT: return truth(result, is_unsigned ? a > b : sa > sb);
+        case OP_LE: return truth(result, is_unsigned ? a <= b : sa <= sb);
+        case OP_GE: return truth(result, is_unsigned ? a >= b : sa >= sb);
+        case OP_EQ: return truth(result, a == b);
+        case OP_NE: return truth(result, a != b);
+        case OP_AND: return truth(result, a != 0 && b != 0);
+        case OP_OR: return truth(result, a != 0 || b != 0);
+        default: return 0;
+    }
+    if (type == TYPE_FLOAT) return 0;
+    result->type = type;
+    result->value.u = u;
+    return 1;
+}
+
+// Only the side arrays change, the node and its children stay where they are
+static void make_literal(FlatAST* ast, NodeId node, Constant constant, int propagated) {
+    ast->folded[node] = FOLD_CONSTANT | (propagated ? FOLD_PROPAGATED : 0);
+    ast->data_type[node] = constant.type;
+    ast->var_index[node] = VAR_NONE;
+    ast->value[node] = constant.value;
+}
+
+static int is_propagated(const FlatAST* ast, NodeId node) {
+    return (ast->folded[node] & FOLD_PROPAGATED) != 0;
+}
+
+// The checker looks at the operator of a condition (through any '!'), only
+// comparisons may be folded there
+static int in_condition(const FlatAST* ast, const WalkFrame* frame) {
+    const NodeId parent = frame->parent;
+    if (parent == NODE_NONE) return 0;
+    switch (flat_type(ast, parent)) {
+        case AST_IF:
+        case AST_WHILE:
+            return frame->slot == AST_SLOT_LEFT;
+        case AST_REPEAT:
+            return frame->slot == AST_SLOT_RIGHT;
+        case AST_UNARYOP:
+            return flat_kind(ast, parent) == OP_NOT;
+        default:
+            return 0;
+    }
+}
+
+static void fold_binop(FlatAST* ast, const WalkFrame* frame) {
+    const NodeId node = frame->node;
+    const NodeId left_node = flat_left(ast, node);
+    const NodeId right_node = flat_right(ast, node);
+    const DataType type = ast->data_type[node];
+    Constant left, right, result;
+    if (type == TYPE_ERROR || !literal_value(ast, left_node, &left) || !literal_value(ast, right_node, &right)) return;
+    if (in_condition(ast, frame) && !is_comparison(flat_kind(ast, node))) return;
+    if (fold_binary(flat_kind(ast, node), left, right, type, &result)) {
+        make_literal(ast, node, result, is_propagated(ast, left_node) || is_propagated(ast, right_node));
+    }
+}
+
+static void fold_unary(Constants* constants, FlatAST* ast, const WalkFrame* frame) {
+    const NodeId node = frame->node;
+    const NodeId operand = flat_right(ast, node);
+    const TokenKind op = flat_kind(ast, node);
+    if (op == OP_INC || op == OP_DEC) {
+        if (operand != NODE_NONE && folded_type(ast, operand) == AST_IDENTIFIER) forget(constants, ast->var_index[operand]);
+        return;
+    }
+    Constant result;
+    if (ast->data_type[node] == TYPE_ERROR || !literal_value(ast, operand, &result)) return;
+    if (in_condition(ast, frame) && op != OP_NOT) return;
+    switch (op) {
+        case OP_ADD:
+            break;
+        case OP_SUB:
+            if (result.type == TYPE_FLOAT) result.value.f = -result.value.f;
+            else result.value.u = 0 - result.value.u;
+            break;
+        case OP_BITNOT:
+            if (result.type == TYPE_FLOAT) return;
+            result.value.u = ~result.value.u;
+            break;
+        case OP_NOT:
+            truth(&result, result.type == TYPE_FLOAT ? result.value.f == 0 : result.value.u == 0);
+            break;
+        default:
+            return;
+    }
+    if (result.type != ast->data_type[node]) return;
+    make_literal(ast, node, result, is_propagated(ast, operand));
+}
+
+// A read of a known variable becomes its value
+static void propagate(const Constants* constants, FlatAST* ast, const WalkFrame* frame) {
+    const NodeId node = frame->node;
+    const NodeId parent = frame->parent;
+    if (parent != NODE_NONE) {
+        const TokenKind op = flat_kind(ast, parent);
+        if (flat_type(ast, parent) == AST_ASSIGN && frame->slot == AST_SLOT_LEFT) return;
+        if (flat_type(ast, parent) == AST_UNARYOP && (op == OP_INC || op == OP_DEC)) return;
+    }
+    const DataType type = ast->data_type[node];
+    const int var = ast->var_index[node];
+    if (!is_number(type) || !is_known(constants, var)) return;
+    make_literal(ast, node, (Constant){ type, constants->values[var] }, 1);
+}
+
+_Static_assert(OP_XOR_ASSIGN - OP_ADD_ASSIGN == OP_XOR - OP_ADD, "compound assignments no longer line up with their operators");
+
+static int assigned_value(const Constants* constants, const FlatAST* ast, NodeId node, Constant* value) {
+    if (!literal_value(ast, flat_right(ast, node), value)) return 0;
+    const TokenKind kind = flat_kind(ast, node);
+    if (kind == OP_ASSIGN) return 1;
+    // x op= e is x = x op e
+    const NodeId target = flat_left(ast, node);
+    const int var = ast->var_index[target];
+    if (!IS_ASSIGN_KIND(kind) || !is_known(constants, var)) return 0;
+    const TokenKind op = OP_ADD + (kind - OP_ADD_ASSIGN);
+    const Constant old = { ast->data_type[target], constants->values[var] };
+    return fold_binary(op, old, *value, get_result_type(old.type, value->type, op), value);
+}
+
+static void assign(Constants* constants, const FlatAST* ast, NodeId node) {
+    const NodeId target = flat_left(ast, node);
+    if (target == NODE_NONE) return;
+    const ASTType target_type = folded_type(ast, target);
+    const int var = ast->var_index[target];
+    if ((target_type != AST_IDENTIFIER && target_type != AST_VARDECL) || var == VAR_NONE) return;
+    const DataType type = ast->data_type[target];
+    Constant value;
+    if (ast->data_type[node] != TYPE_ERROR && is_number(type) &&
+        assigned_value(constants, ast, node, &value) && convert_constant(&value, type)) {
+        set_value(constants, var, value.value);
+    } else {
+        forget(constants, var);
+    }
+}
+
+void fold_enter(Constants* constants, const FlatAST* ast, const WalkFrame* frame) {
+    const NodeId node = frame->node;
+    switch (flat_type(ast, node)) {
+        case AST_IF:
+            constants->marks = grow(constants->marks, &constants->mark_capacity, constants->mark_count + 1, sizeof(int));
+            constants->marks[constants->mark_count++] = constants->written_count;
+            break;
+        case AST_WHILE:
+        case AST_REPEAT:
+            open_scope(constants);
+            break;
+        case AST_VARDECL:
+            if (flat_body(ast, node) != NODE_NONE) open_scope(constants);
+            break;
+        default:
+            break;
+    }
+}
+
+void fold_leave(Constants* constants, FlatAST* ast, const WalkFrame* frame) {
+    const NodeId node = frame->node;
+    switch (flat_type(ast, node)) {
+        case AST_IDENTIFIER:
+            propagate(constants, ast, frame);
+            break;
+        case AST_BINOP:
+            fold_binop(ast, frame);
+            break;
+        case AST_UNARYOP:
+            fold_unary(constants, ast, frame);
+            break;
+        case AST_ASSIGN:
+            assign(constants, ast, node);
+            break;
+        case AST_FUNCTION_CALL:
+            // factorial has no var_index and no side effects
+            if (ast->var_index[node] != VAR_NONE) {
+                constants->calls++;
+                forget_all(constants);
+            }
+            break;
+        case AST_WHILE:
+        case AST_REPEAT:
+            close_scope(constants, 0);
+            break;
+        case AST_VARDECL:
+            if (flat_body(ast, node) != NODE_NONE) close_scope(constants, 1);
+            break;
+        case AST_IF:
+            end_branch(constants);
+            if (constants->mark_count > 0 && --constants->mark_count == 0) constants->written_count = 0;
+            break;
+        default:
+            break;
+    }
+    // the else branch doesn't see what the then branch did
+    if (frame->parent != NODE_NONE && flat_type(ast, frame->parent) == AST_IF && frame->slot == AST_SLOT_RIGHT) end_branch(constants);
+}
+
+void fold_free(Constants* constants) {
+    free(constants->values);
+    free(constants->known);
+    free(constants->scopes);
+    free(constants->written);
+    free(constants->marks);
+    memset(constants, 0, sizeof(Constants));
+}
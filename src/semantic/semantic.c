@@ -1,7 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
+#if defined(HAVE_PTHREAD) && defined(HAVE_SYSCONF) && defined(HAVE_OPEN_MEMSTREAM)
+#define CHECK_THREADS 1
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
 #include "tokens.h"
 #include "semantic.h"
+#include "fold.h"
 #include "parser.h"
 #include "lexer.h"
 
@@ -11,107 +18,166 @@ Step 2
 
 */
 
+#define INITIAL_SYMBOL_SLOTS 256
+
 // Initialize a new symbol table
 // Creates an empty symbol table structure with scope level set to 0
 SymbolTable* init_symbol_table() {
-    SymbolTable* table = malloc(sizeof(SymbolTable));
-    if (table) {
-        table->head = NULL;
-        table->current_scope = 0;
+    SymbolTable* table = calloc(1, sizeof(SymbolTable));
+    if (!table) return NULL;
+    table->slots = calloc(INITIAL_SYMBOL_SLOTS, sizeof(SymbolSlot));
+    if (!table->slots) {
+        free(table);
+        return NULL;
     }
+    table->capacity = INITIAL_SYMBOL_SLOTS;
+    // calloc'd slots are epoch 0, so they start out empty
+    table->epoch = 1;
+    pool_init(&table->symbols, sizeof(Symbol), POOL_SLAB_OBJECTS);
     return table;
 }
 
+// Interned name of a token, the lexer already did it for identifiers
+static InternId token_name(const Token name) {
+    return name.id != INTERN_NONE ? name.id : intern(name.start, (size_t)name.length);
+}
+
+// IDs are small and dense, spread them over the table
+static inline uint32_t name_hash(InternId name) {
+    return name * 2654435761u;
+}
+
+// Slot of name, or the empty slot where it would go
+static SymbolSlot* find_slot(SymbolSlot* slots, uint32_t capacity, uint32_t epoch, InternId name) {
+    uint32_t i = name_hash(name) & (capacity - 1);
+    while (slots[i].epoch == epoch && slots[i].name != name) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+static int grow_slots(SymbolTable* table) {
+    uint32_t capacity = table->capacity * 2;
+    SymbolSlot* slots = calloc(capacity, sizeof(SymbolSlot));
+    if (!slots) return -1;
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].epoch != table->epoch) continue;
+        *find_slot(slots, capacity, table->epoch, table->slots[i].name) = table->slots[i];
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
 // Add a symbol to the table
-// Inserts a new variable with given name, type, and line number into the current scope
-Symbol* add_symbol(SymbolTable* table, const char* name, int type, int line) {
-    Symbol* symbol = malloc(sizeof(Symbol));
+// Inserts a new variable with given name, type, and line number into the current scope,
+// it hides any outer symbol of the same name until the scope is exited
+Symbol* add_symbol(SymbolTable* table, const Token name, int type, int line) {
+    // keep the table at most half full
+    if (table->used * 2 >= table->capacity && grow_slots(table) != 0) return NULL;
+    if (table->variable_count == table->variable_capacity) {
+        int capacity = table->variable_capacity ? table->variable_capacity * 2 : 256;
+        Variable* grown = realloc(table->variables, sizeof(Variable) * capacity);
+        if (!grown) return NULL;
+        table->variables = grown;
+        table->variable_capacity = capacity;
+    }
+    Symbol* symbol = pool_alloc(&table->symbols);
     if (symbol) {
-        strcpy(symbol->name, name);
+        symbol->name = token_name(name);
         symbol->type = type;
         symbol->scope_level = table->current_scope;
-        symbol->line_declared = line;
+        symbol->var_index = table->variable_count++;
         symbol->is_initialized = 0;
+        table->variables[symbol->var_index] = (Variable){ symbol->name, type, table->current_scope, line };
         symbol->next = table->head;
         table->head = symbol;
+
+        SymbolSlot* slot = find_slot(table->slots, table->capacity, table->epoch, symbol->name);
+        if (slot->epoch != table->epoch) {
+            *slot = (SymbolSlot){ symbol->name, table->epoch, NULL };
+            table->used++;
+        }
+        symbol->shadowed = slot->symbol;
+        slot->symbol = symbol;
     }
     return symbol;
 }
 
 // Look up a symbol in the table
-// Searches for a variable by name across all accessible scopes
+// Only live symbols are in the table, the innermost one with the name is visible
 // Returns the symbol if found, NULL otherwise
-Symbol* lookup_symbol(SymbolTable* table, const char* name) {
-    Symbol* current = table->head;
-    while (current) {
-        if (strcmp(current->name, name) == 0 && current->scope_level <= table->current_scope) {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+Symbol* lookup_symbol(SymbolTable* table, const Token name) {
+    SymbolSlot* slot = find_slot(table->slots, table->capacity, table->epoch, token_name(name));
+    return slot->epoch == table->epoch ? slot->symbol : NULL;
 }
 
 // Look up symbol in current scope only
-Symbol* lookup_symbol_current_scope(SymbolTable* table, const char* name) {
-    Symbol* current = table->head;
-    while (current) {
-        if (strcmp(current->name, name) == 0 && 
-            current->scope_level == table->current_scope) {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+Symbol* lookup_symbol_current_scope(SymbolTable* table, const Token name) {
+    Symbol* symbol = lookup_symbol(table, name);
+    return symbol && symbol->scope_level == table->current_scope ? symbol : NULL;
 }
 
 // Enter a new scope level
 // Increments the current scope level when entering a block (e.g., if, while)
+// and remembers where its symbols start
 void enter_scope(SymbolTable* table) {
-    table->current_scope++;
+    if (table->current_scope == table->scope_capacity) {
+        int capacity = table->scope_capacity ? table->scope_capacity * 2 : 16;
+        Symbol** grown = realloc(table->scope_marks, sizeof(Symbol*) * capacity);
+        if (!grown) {
+            fprintf(stderr, "No memory for the symbol table\n");
+            exit(1);
+        }
+        table->scope_marks = grown;
+        table->scope_capacity = capacity;
+    }
+    table->scope_marks[table->current_scope++] = table->head;
 }
 
 // Exit the current scope
-// Decrements the current scope level when leaving a block
-// Optionally removes symbols that are no longer in scope
+// Drops the symbols declared in it and decrements the current scope level
 void exit_scope(SymbolTable* table) {
+    remove_symbols_in_current_scope(table);
     table->current_scope--;
 }
 
 // Remove symbols from the current scope
-// Cleans up symbols that are no longer accessible after leaving a scope
+// Symbols are stacked in declaration order, so the current scope's are the
+// ones above its mark, each one uncovers the symbol it shadowed
 void remove_symbols_in_current_scope(SymbolTable* table) {
-    Symbol* current = table->head;
-    Symbol* prev = NULL;
+    Symbol* mark = table->current_scope > 0 ? table->scope_marks[table->current_scope - 1] : NULL;
+    while (table->head != mark) {
+        Symbol* symbol = table->head;
+        find_slot(table->slots, table->capacity, table->epoch, symbol->name)->symbol = symbol->shadowed;
+        table->head = symbol->next;
+        pool_release(&table->symbols, symbol);
+    }
+}
 
-    while (current) {
-        if (current->scope_level == table->current_scope) {
-            // Remove this symbol
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                table->head = current->next;
-            }
-            Symbol* to_free = current;
-            current = current->next;
-            // free(to_free->name); // this fixed an error
-            free(to_free);
-        } else {
-            prev = current;
-            current = current->next;
-        }
+// Empty the table for the next compilation
+// Bumping the epoch empties every slot at once, the pool takes all symbols back
+void reset_symbol_table(SymbolTable* table) {
+    table->head = NULL;
+    table->current_scope = 0;
+    table->used = 0;
+    table->variable_count = 0;
+    if (++table->epoch == 0) {
+        // wrapped around, stale slots could look current again
+        memset(table->slots, 0, sizeof(SymbolSlot) * table->capacity);
+        table->epoch = 1;
     }
+    pool_reset(&table->symbols);
 }
 
 // Free the symbol table memory
 // Releases all allocated memory when the symbol table is no longer needed
 void free_symbol_table(SymbolTable* table) {
-    Symbol* current = table->head;
-    while (current) {
-        Symbol* next = current->next;
-        free(current);
-        current = next;
-    }
+    pool_free(&table->symbols);
+    free(table->slots);
+    free(table->scope_marks);
+    free(table->variables);
     free(table);
 }
 
@@ -122,10 +188,21 @@ Step 3
 */
 
 // Main semantic analysis function
-int analyze_semantics(ASTNode* ast) {
-    printf("Starting semantic analysis...\n");
+int analyze_semantics(FlatAST* ast) {
     SymbolTable* table = init_symbol_table();
-    int result = check_program(ast, table);
+    if (!table) {
+        fprintf(stderr, "No memory for the symbol table\n");
+        return 0;
+    }
+    int result = analyze_semantics_with(ast, table);
+    free_symbol_table(table);
+    return result;
+}
+
+int analyze_semantics_with(FlatAST* ast, SymbolTable* table) {
+    printf("Starting semantic analysis...\n");
+    reset_symbol_table(table);
+    int result = check_program(ast, 0, table);
     
     // Print symbol table contents
     printf("\nSymbol Table Contents:\n");
@@ -137,510 +214,764 @@ int analyze_semantics(ASTNode* ast) {
     } else {
         printf("\nSemantic analysis failed. Errors detected.\n");
     }
-    
-    free_symbol_table(table);
     return result;
 }
 
-DataType check_type(char* lexemme){
-    if (strcmp(lexemme, "int") == 0) return TYPE_INT;
-    else if (strcmp(lexemme, "uint") == 0) return TYPE_UINT;
-    else if (strcmp(lexemme, "float") == 0) return TYPE_FLOAT;
-    else if (strcmp(lexemme, "string") == 0) return TYPE_STRING;
-    else if (strcmp(lexemme, "char") == 0) return TYPE_CHAR;
-    else return TYPE_UNKNOWN;
+DataType check_type(const Token t){
+    switch (t.kind) {
+        case KW_INT: return TYPE_INT;
+        case KW_UINT: return TYPE_UINT;
+        case KW_FLOAT: return TYPE_FLOAT;
+        case KW_STRING: return TYPE_STRING;
+        case KW_CHAR: return TYPE_CHAR;
+        default: return TYPE_UNKNOWN;
+    }
+}
+
+/* The checker is a single ast_walk over the tree.
+ * Declarations and scopes are handled on the way down, types on the way up:
+ * every expression node gets its data_type once all its children have
+ * theirs, so each node is typed exactly once and checks just read the side
+ * arrays of the children. TYPE_ERROR marks a node whose error was already reported,
+ * nodes built on top of it stay quiet instead of cascading more errors.
+ */
+typedef struct CheckTask CheckTask;
+
+typedef struct {
+    FlatAST* ast;
+    SymbolTable* table;
+    int result;
+    FILE* out;                  // Progress and diagnostics, stdout unless checking in parallel
+    // Checking a function body in parallel, see check_parallel()
+    SymbolTable* globals;       // Read only, NULL when checking sequentially
+    int visible;                // Globals with a lower var_index were declared before the body
+    int local_base;             // Added to the var_index of symbols from table
+    // Pass 1 of the parallel mode, top level function bodies are queued instead
+    int defer;
+    CheckTask* tasks;
+    int task_count;
+    int task_capacity;
+    Constants constants;        // Folding as the nodes are typed, see fold.h
+} Checker;
+
+static void report_error(FILE* out, SemanticErrorType error, const char* name, int name_length, int line);
+
+static void checker_error(Checker* checker, SemanticErrorType error, const char* name, int line) {
+    report_error(checker->out, error, name, (int)strlen(name), line);
 }
 
+static void checker_error_token(Checker* checker, SemanticErrorType error, const Token name, int line) {
+    report_error(checker->out, error, name.start, name.length, line);
+}
 
-int check_args(ASTNode *node, SymbolTable *table) {
-    ASTNode* cur = node;
-    int result = 1;
-    while (cur) {
-        result = check_declaration(cur, table) && result;
-        cur = cur->next;
+// Innermost visible declaration of name, *var_index is where the AST records it
+static Symbol* resolve(Checker* checker, const Token name, int* var_index) {
+    Symbol* symbol = lookup_symbol(checker->table, name);
+    if (symbol) {
+        *var_index = checker->local_base + symbol->var_index;
+        return symbol;
     }
-    return result;
+    if (!checker->globals) return NULL;
+    symbol = lookup_symbol(checker->globals, name);
+    if (!symbol || symbol->var_index >= checker->visible) return NULL;
+    *var_index = symbol->var_index;
+    return symbol;
 }
 
-// Check a variable declaration
-int check_declaration(ASTNode* node, SymbolTable* table) {
-    if (node->type != AST_VARDECLTYPE) return 0;
-
-    printf("Checking\n");
+// Type of a child expression, a missing child (parse error) counts as failed
+static inline DataType child_type(const FlatAST* ast, NodeId child) {
+    return child != NODE_NONE ? (DataType)ast->data_type[child] : TYPE_ERROR;
+}
 
-    if (node->body->type == AST_VARDECL) {
-        printf("vardecl %s\n", node->body->current.lexeme);
-        const char* name = node->body->current.lexeme;
-        Symbol* existing = lookup_symbol_current_scope(table, name);
-        if (existing) {
-            semantic_error(SEM_ERROR_REDECLARED_VARIABLE, name, node->current.line);
-            return 0;
-        }
+// Token type of a literal, folded ones hold a number
+static TokenType literal_token_type(const FlatAST* ast, NodeId literal) {
+    if (!ast->folded[literal]) return FLAT_TOKEN_TYPE(ast->info[literal]);
+    return ast->data_type[literal] == TYPE_FLOAT ? TOKEN_FLOAT : TOKEN_NUMBER;
+}
 
-        // When we add a symbol, mark it as initialized immediately
-        // This fixes the issue with 'int x;' being considered uninitialized
-        const DataType t = check_type(node->current.lexeme);
-
-        add_symbol(table, name, t, node->current.line);
-        printf("Symbol declared %s of type %d\n", node->body->current.lexeme, t);
-
-        Symbol* symbol = lookup_symbol_current_scope(table, name);
-        if (symbol) symbol->is_initialized = 1;  // Mark as initialized upon declaration
-        ASTNode* func_block = node->body->body;
-        ASTNode* func_args = node->body->right;
-        if (func_block && func_args) {
-            printf("Found Function Declaration Args and Block\n");
-            enter_scope(table);
-            int result = check_args(func_args, table) && check_block(func_block, table);
-            //remove_symbols_in_current_scope(table);
-            exit_scope(table);
-            return result;
-        }
-    } else if (node->body->type == AST_ASSIGN) {
-        ASTNode* assignment = node->body;
-        const char* name = assignment->left->current.lexeme;
-        printf("vardecl assign %s\n", name);
-        Symbol* existing = lookup_symbol_current_scope(table, name);
-        if (existing) {
-            semantic_error(SEM_ERROR_REDECLARED_VARIABLE, name, assignment->left->current.line);
-            return 0;
-        }
+static void fail(Checker* checker) {
+    checker->result = 0;
+}
 
-        // When we add a symbol, mark it as initialized immediately
-        // This fixes the issue with 'int x;' being considered uninitialized
-        const DataType lhs_type = check_type(node->current.lexeme);
-        Symbol* symbol = add_symbol(table, name, lhs_type, assignment->left->current.line);
-        printf("Symbol declared %s of type %d\n", name, lhs_type);
-        if (symbol) symbol->is_initialized = 1;  // Mark as initialized upon declaration
-        if (!check_expression(assignment->right, table)) {
-            return 0;
-        }
-        const DataType rhs_type = get_expression_type(assignment->right, table);
-        
-        if (check_type_compatibility(lhs_type, rhs_type) == TYPE_COMPAT_ERROR) {
-            semantic_error(SEM_ERROR_TYPE_MISMATCH, name, assignment->left->current.line);
+static int is_expression(ASTType type) {
+    switch (type) {
+        case AST_BINOP:
+        case AST_UNARYOP:
+        case AST_LITERAL:
+        case AST_IDENTIFIER:
+        case AST_FUNCTION_CALL:
+        case AST_ASSIGN:
+            return 1;
+        default:
             return 0;
-        }
     }
-
-    return 1;
 }
 
-// Check program node
-int check_program(ASTNode* node, SymbolTable* table) {
-    if (!node) return 1;
-
-    int result = 1;
-    if (node->body) {
-        ASTNode* cur = node->body;
-        while (cur) {
-            result = check_statement(cur, table) && result;
-            cur = cur->next;
-        }
+static DataType literal_type(const Token literal) {
+    switch (literal.type) {
+        case TOKEN_NUMBER: return TYPE_INT;
+        case TOKEN_FLOAT: return TYPE_FLOAT;
+        case TOKEN_STRING: return TYPE_STRING;
+        default: return TYPE_UNKNOWN;
     }
-
-    return result;
 }
 
-// Check a variable assignment
-int check_assignment(ASTNode* node, SymbolTable* table) {
-    if (!node->left || !node->right) {
+// Check a variable or function declaration, returns 0 if it's skipped
+static int check_declaration(NodeId node, Checker* checker) {
+    FlatAST* ast = checker->ast;
+    NodeId decl = flat_body(ast, node);
+    // int x without a ';' has no body, the parser already complained
+    if (decl == NODE_NONE) return 1;
+
+    fprintf(checker->out, "Checking\n");
+    if (flat_type(ast, decl) == AST_ASSIGN) {
+        decl = flat_left(ast, decl);
+        const Token name = flat_ast_token(ast, decl);
+        fprintf(checker->out, "vardecl assign " TOKEN_FMT "\n", TOKEN_ARG(name));
+    } else {
+        const Token name = flat_ast_token(ast, decl);
+        fprintf(checker->out, "vardecl " TOKEN_FMT "\n", TOKEN_ARG(name));
+    }
+    if (flat_type(ast, decl) != AST_VARDECL) return 1;
+
+    const Token name = flat_ast_token(ast, decl);
+    Symbol* existing = lookup_symbol_current_scope(checker->table, name);
+    if (existing) {
+        checker_error_token(checker, SEM_ERROR_REDECLARED_VARIABLE, name, name.line);
+        fail(checker);
         return 0;
     }
 
-    const char* name = node->left->current.lexeme;
-    printf("Checking assignment to variable '%s'\n", name);
+    // When we add a symbol, mark it as initialized immediately
+    // This fixes the issue with 'int x;' being considered uninitialized
+    const DataType t = check_type(flat_ast_token(ast, node));
+    Symbol* symbol = add_symbol(checker->table, name, t, name.line);
+    fprintf(checker->out, "Symbol declared " TOKEN_FMT " of type %d\n", TOKEN_ARG(name), t);
+    if (symbol) {
+        symbol->is_initialized = 1;  // Mark as initialized upon declaration
+        ast->var_index[decl] = checker->local_base + symbol->var_index;
+    }
+    ast->data_type[decl] = t;
+    return 1;
+}
 
-    Symbol* symbol = lookup_symbol(table, name);
-    if (!symbol) {
-        semantic_error(SEM_ERROR_UNDECLARED_VARIABLE, name, node->left->current.line);
-        return 0;
+// x = expr and the initializer of int x = expr
+static DataType check_assignment(NodeId node, Checker* checker) {
+    const FlatAST* ast = checker->ast;
+    const NodeId target = flat_left(ast, node);
+    // only a variable can be assigned to, a + b = 3 has nothing to store into
+    if (target == NODE_NONE || (folded_type(ast, target) != AST_IDENTIFIER && folded_type(ast, target) != AST_VARDECL)) {
+        const Token op = flat_ast_token(ast, node);
+        checker_error_token(checker, SEM_ERROR_INVALID_OPERATION, op, op.line);
+        fail(checker);
+        return TYPE_ERROR;
     }
+    const DataType rhs = child_type(ast, flat_right(ast, node));
+    // the declaration itself was checked on the way down and typed the name
+    const DataType lhs = child_type(ast, target);
+    if (lhs == TYPE_ERROR || rhs == TYPE_ERROR) return TYPE_ERROR;
+
+    if (check_type_compatibility(lhs, rhs) == TYPE_COMPAT_ERROR) {
+        const Token name = flat_ast_token(ast, target);
+        checker_error_token(checker, SEM_ERROR_TYPE_MISMATCH, name, name.line);
+        fail(checker);
+        return TYPE_ERROR;
+    }
+    return lhs;
+}
 
-    if (node->type == AST_ASSIGN) {
-        DataType left_type = symbol->type;
-        DataType right_type = get_expression_type(node->right, table);
+static DataType check_binop(NodeId node, Checker* checker) {
+    const FlatAST* ast = checker->ast;
+    const NodeId divisor = flat_right(ast, node);
+    const TokenKind op = flat_kind(ast, node);
+    const DataType left = child_type(ast, flat_left(ast, node));
+    const DataType right = child_type(ast, divisor);
+    if (left == TYPE_ERROR || right == TYPE_ERROR) return TYPE_ERROR;
+
+    TypeCompatibility compat = check_type_compatibility(left, right);
+    if (compat == TYPE_COMPAT_ERROR) {
+        const Token token = flat_ast_token(ast, node);
+        checker_error_token(checker, SEM_ERROR_TYPE_MISMATCH, token, token.line);
+        fail(checker);
+        return TYPE_ERROR;
+    }
 
-        if ((left_type == TYPE_INT || left_type == TYPE_UINT || left_type == TYPE_CHAR) && 
-            (right_type == TYPE_INT || right_type == TYPE_UINT || right_type == TYPE_CHAR)) {
-            return 1;
+    // Add division by zero check
+    if (op == OP_DIV) {
+        // If right operand is a literal number, constant divisors are folded into one by now.
+        // One that only stands for a variable's value doesn't count, the division may be
+        // in a branch that can't run with that value
+        const TokenType type = literal_token_type(ast, divisor);
+        const TokenValue value = ast->value[divisor];
+        if (folded_type(ast, divisor) == AST_LITERAL && !(ast->folded[divisor] & FOLD_PROPAGATED) &&
+            ((type == TOKEN_NUMBER && value.u == 0) ||
+             (type == TOKEN_FLOAT && value.f == 0))) {
+            checker_error(checker, SEM_ERROR_INVALID_OPERATION, "division by zero", flat_line(ast, node));
+            fail(checker);
+            return TYPE_ERROR;
         }
+    }
+    return get_result_type(left, right, op);
+}
 
-        semantic_error(SEM_ERROR_TYPE_MISMATCH, symbol->name, node->current.line);
-        return 0;
+// factorial(arg) is parsed as a call and recognised by name
+static DataType check_factorial(NodeId node, Checker* checker) {
+    const FlatAST* ast = checker->ast;
+    const NodeId arg = flat_body(ast, node);
+    // Factorial requires exactly one argument
+    if (arg == NODE_NONE || flat_next(ast, arg) != NODE_NONE) {
+        checker_error(checker, SEM_ERROR_INVALID_OPERATION, "factorial requires exactly one argument", flat_line(ast, node));
+        fail(checker);
+        return TYPE_ERROR;
+    }
+    const DataType arg_type = child_type(ast, arg);
+    if (arg_type == TYPE_ERROR) return TYPE_ERROR;
+    // Check argument type (must be int or uint)
+    if (arg_type != TYPE_INT && arg_type != TYPE_UINT) {
+        checker_error(checker, SEM_ERROR_TYPE_MISMATCH, "factorial argument must be integer", flat_line(ast, node));
+        fail(checker);
+        return TYPE_ERROR;
     }
+    // Factorial returns int
+    return TYPE_INT;
+}
 
-    // Regular assignment
-    return check_expression(node->right, table);
+static DataType check_call(NodeId node, Checker* checker) {
+    FlatAST* ast = checker->ast;
+    const Token name = flat_ast_token(ast, node);
+    // Special handling for factorial
+    if (token_is(name, "factorial")) {
+        return check_factorial(node, checker);
+    }
+    int ok = 1;
+    for (NodeId arg = flat_body(ast, node); arg != NODE_NONE; arg = flat_next(ast, arg)) {
+        ok = ast->data_type[arg] != TYPE_ERROR && ok;
+    }
+    int var_index;
+    Symbol* symbol = resolve(checker, name, &var_index);
+    if (!symbol) {
+        checker_error(checker, SEM_ERROR_INVALID_OPERATION, "unknown function", name.line);
+        fail(checker);
+        return TYPE_ERROR;
+    }
+    ast->var_index[node] = var_index;
+    return ok ? (DataType)symbol->type : TYPE_ERROR;
 }
 
-DataType get_expression_type(ASTNode* node, SymbolTable* table) {
-    if (!node) return TYPE_UNKNOWN;
+// Check a condition (e.g., in if statements) once it has been typed
+static void check_condition(NodeId node, Checker* checker, int line) {
+    const FlatAST* ast = checker->ast;
+    if (node == NODE_NONE) {
+        checker_error(checker, SEM_ERROR_INVALID_OPERATION, "condition", line);
+        fail(checker);
+        return;
+    }
+    if (ast->data_type[node] == TYPE_ERROR) return;
 
-    switch (node->type) {
-        case AST_LITERAL:
-            switch (node->current.type) {
-                case TOKEN_NUMBER: return TYPE_INT;
-                case TOKEN_FLOAT: return TYPE_FLOAT;
-                case TOKEN_STRING: return TYPE_STRING;
-                case TOKEN_IDENTIFIER: 
-                    // Look up the actual type from symbol table instead of assuming CHAR
-                    {
-                        Symbol* sym = lookup_symbol(table, node->current.lexeme);
-                        return sym ? sym->type : TYPE_UNKNOWN;
-                    }
-                    
-                default: return TYPE_UNKNOWN;
-            }
-        
-        case AST_IDENTIFIER: {
-            Symbol* sym = lookup_symbol(table, node->current.lexeme);
-            if (!sym) {
-                semantic_error(SEM_ERROR_UNDECLARED_VARIABLE, node->current.lexeme, node->current.line);
-                return TYPE_UNKNOWN;
-            }
-            return sym->type;
-        }
+    // Only allow logical NOT in conditions, !!x is checked like x
+    while (folded_type(ast, node) == AST_UNARYOP && flat_kind(ast, node) == OP_NOT && flat_right(ast, node) != NODE_NONE) {
+        node = flat_right(ast, node);
+    }
 
+    switch (folded_type(ast, node)) {
         case AST_BINOP: {
-            DataType left_type = get_expression_type(node->left, table);
-            DataType right_type = get_expression_type(node->right, table);
-            return get_result_type(left_type, right_type, node->current.lexeme);
+            // Operand types were checked with the expression
+            const TokenKind op = flat_kind(ast, node);
+            int is_comparison = (op == OP_LT || op == OP_GT || op == OP_LE || 
+                                 op == OP_GE || op == OP_EQ || op == OP_NE ||
+                                 op == OP_AND || op == OP_OR);
+            if (!is_comparison) {
+                checker_error(checker, SEM_ERROR_INVALID_OPERATION, "Invalid condition operator", flat_line(ast, node));
+                fail(checker);
+            }
+            return;
         }
 
-        case AST_FUNCTION_CALL: {
-            DataType operand_type = get_expression_type(node->body, table);
-            if (operand_type != TYPE_INT && operand_type != TYPE_UINT) {
-                semantic_error(SEM_ERROR_TYPE_MISMATCH, "factorial", node->current.line);
-                return TYPE_UNKNOWN;
+        case AST_UNARYOP:
+            checker_error(checker, SEM_ERROR_INVALID_OPERATION, "Invalid unary operator in condition", flat_line(ast, node));
+            fail(checker);
+            return;
+
+        case AST_IDENTIFIER:
+        case AST_LITERAL: {
+            // Allow boolean/numeric values in conditions
+            DataType type = ast->data_type[node];
+            if (type != TYPE_INT && type != TYPE_UINT && type != TYPE_FLOAT) {
+                checker_error(checker, SEM_ERROR_TYPE_MISMATCH, "Condition must be numeric or boolean", flat_line(ast, node));
+                fail(checker);
             }
-            return TYPE_INT;
+            return;
         }
 
         default:
-            return TYPE_UNKNOWN;
+            checker_error(checker, SEM_ERROR_INVALID_OPERATION, "Invalid condition expression", flat_line(ast, node));
+            fail(checker);
+            return;
     }
 }
 
-TypeCompatibility check_type_compatibility(DataType left, DataType right) {
-    if (left == right) return TYPE_COMPAT_OK;
-    
-    // Handle numeric type conversions - both integers and floats are compatible
-    if ((left == TYPE_INT || left == TYPE_UINT || left == TYPE_FLOAT) &&
-        (right == TYPE_INT || right == TYPE_UINT || right == TYPE_FLOAT)) {
-        return TYPE_COMPAT_OK;  // Changed from TYPE_COMPAT_CONVERT to TYPE_COMPAT_OK
-    }
-    
-    return TYPE_COMPAT_ERROR;
+/* A top level function body only sees the globals declared before it, plus
+ * its own args and locals. In pass 1 of the parallel mode the body is queued
+ * with the number of variables declared so far and skipped, the rest of the
+ * program is checked as usual.
+ */
+struct CheckTask {
+    NodeId function;            // VARDECL with the args in right and the block in body
+    int visible;                // Globals declared before the body, the function included
+    size_t global_output;       // Pass 1 output written before the body
+    int worker;                 // Worker that checked it
+    size_t output_start;        // Its output in that worker's buffer
+    size_t output_end;
+    int var_first;              // Its variables in that worker's table
+    int var_count;
+    int var_base;               // Where they go in the program's table
+};
+
+static int is_deferred(const Checker* checker) {
+    return checker->defer && checker->table->current_scope == 0;
 }
 
-DataType get_result_type(DataType left, DataType right, const char* operator) {
-    // Handle arithmetic operators
-    if (strcmp(operator, "+") == 0 || 
-        strcmp(operator, "-") == 0 || 
-        strcmp(operator, "*") == 0 || 
-        strcmp(operator, "/") == 0) {
-        
-        // If either operand is float, result is float
-        if (left == TYPE_FLOAT || right == TYPE_FLOAT) {
-            return TYPE_FLOAT;
+static int defer_function(NodeId node, Checker* checker) {
+    if (!is_deferred(checker)) return 0;
+    if (checker->task_count == checker->task_capacity) {
+        int capacity = checker->task_capacity ? checker->task_capacity * 2 : 64;
+        CheckTask* grown = realloc(checker->tasks, sizeof(CheckTask) * capacity);
+        if (!grown) {
+            fprintf(stderr, "No memory for the semantic checker\n");
+            exit(1);
         }
-        // If both are integers (signed or unsigned), result is int
-        return TYPE_INT;
-    }
-    
-    // Handle comparison operators
-    if (strcmp(operator, "<") == 0 || 
-        strcmp(operator, ">") == 0 || 
-        strcmp(operator, "<=") == 0 || 
-        strcmp(operator, ">=") == 0 || 
-        strcmp(operator, "==") == 0 || 
-        strcmp(operator, "!=") == 0) {
-        return TYPE_INT;  // Boolean result
+        checker->tasks = grown;
+        checker->task_capacity = capacity;
     }
-    
-    return TYPE_UNKNOWN;
+    checker->tasks[checker->task_count++] = (CheckTask){
+        .function = node,
+        .visible = checker->table->variable_count,
+        .global_output = (size_t)ftell(checker->out),
+    };
+    return 1;
 }
 
-// Update the check_expression function
-int check_expression(ASTNode* node, SymbolTable* table) {
-    if (!node) return 0;
+static WalkAction check_enter(const WalkFrame* frame, void* ctx) {
+    Checker* checker = ctx;
+    const FlatAST* ast = checker->ast;
+    const NodeId node = frame->node;
+    const ASTType type = flat_type(ast, node);
+    fold_enter(&checker->constants, ast, frame);
+    switch (type) {
+        case AST_BLOCK:
+            enter_scope(checker->table);
+            return WALK_CONTINUE;
+        case AST_VARDECLTYPE:
+            return check_declaration(node, checker) ? WALK_CONTINUE : WALK_SKIP;
+        case AST_VARDECL:
+            // a function gets a scope for its arguments, its block one more
+            if (flat_body(ast, node) != NODE_NONE) {
+                if (defer_function(node, checker)) return WALK_SKIP;
+                fprintf(checker->out, "Found Function Declaration Args and Block\n");
+                enter_scope(checker->table);
+            }
+            return WALK_CONTINUE;
+        case AST_ASSIGN: {
+            const NodeId target = flat_left(ast, node);
+            if (target != NODE_NONE && flat_type(ast, target) == AST_IDENTIFIER) {
+                const Token name = flat_ast_token(ast, target);
+                fprintf(checker->out, "Checking assignment to variable '" TOKEN_FMT "'\n", TOKEN_ARG(name));
+            }
+            return WALK_CONTINUE;
+        }
+        default:
+            break;
+    }
+    if (!is_expression(type)) return WALK_CONTINUE;
 
-    printf("Checking expression: ");
-    switch (node->type) {
+    const Token token = flat_ast_token(ast, node);
+    fprintf(checker->out, "Checking expression: ");
+    switch (type) {
         case AST_BINOP:
-            printf("Binary operation '%s'\n", node->current.lexeme);
+            fprintf(checker->out, "Binary operation '" TOKEN_FMT "'\n", TOKEN_ARG(token));
+            break;
+        case AST_UNARYOP:
+            fprintf(checker->out, "Unary operation '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         case AST_IDENTIFIER:
-            printf("Identifier '%s'\n", node->current.lexeme);
+            fprintf(checker->out, "Identifier '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         case AST_LITERAL:
-            printf("Literal '%s'\n", node->current.lexeme);
+            fprintf(checker->out, "Literal '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         case AST_FUNCTION_CALL:
-            printf("Function Call '%s'\n", node->current.lexeme);
+            fprintf(checker->out, "Function Call '" TOKEN_FMT "'\n", TOKEN_ARG(token));
             break;
         default:
-            printf("Unknown expression type\n");
+            fprintf(checker->out, "Unknown expression type\n");
     }
-    
-    switch (node->type) {
-        case AST_BINOP: {
-            // Check left and right operands recursively
-            if (!check_expression(node->left, table) || 
-                !check_expression(node->right, table)) {
-                return 0;
-            }
+    return WALK_CONTINUE;
+}
 
-            DataType left_type = get_expression_type(node->left, table);
-            DataType right_type = get_expression_type(node->right, table);
-            TypeCompatibility compat = check_type_compatibility(left_type, right_type);
-            if (compat == TYPE_COMPAT_ERROR) {
-                semantic_error(SEM_ERROR_TYPE_MISMATCH, node->current.lexeme, node->current.line);
-                return 0;
-            }
-            // Get the result type and store it for future use
-            // THIS IS NOT ALLOWED
-            //node->type = get_result_type(left_type, right_type, node->current.lexeme);
-
-            // Add division by zero check
-            if (strcmp(node->current.lexeme, "/") == 0) {
-                // If right operand is a literal number
-                if (node->right->type == AST_LITERAL && 
-                    node->right->current.type == TOKEN_NUMBER) {
-                    int value = atoi(node->right->current.lexeme);
-                    if (value == 0) {
-                        semantic_error(SEM_ERROR_INVALID_OPERATION, "division by zero", node->current.line);
-                        return 0;
-                    }
-                }
-            }
-            
-            return 1;
-        }
-        
-        case AST_UNARYOP: {
-            if (!check_expression(node->right, table)) return 0;
-            
-            DataType operand_type = get_expression_type(node->right, table);
-            // Validate unary operator compatibility
-            if (strcmp(node->current.lexeme, "!") == 0) {
-                // Logical NOT - result is always boolean (int)
-                // THIS IS NOT ALLOWED
-                //node->type = TYPE_INT;
-            } else if (strcmp(node->current.lexeme, "-") == 0) {
-                // Numeric negation - preserve operand type
-                // THIS IS NOT ALLOWED
-                //node->type = operand_type;
-            }
-            return 1;
-        }
-        
+// Bottom-up part of the walk, all children of node are typed by now
+static void check_leave(const WalkFrame* frame, void* ctx) {
+    Checker* checker = ctx;
+    FlatAST* ast = checker->ast;
+    const NodeId node = frame->node;
+    const int line = flat_line(ast, node);
+    switch (flat_type(ast, node)) {
+        case AST_BLOCK:
+            exit_scope(checker->table);
+            break;
+        case AST_VARDECL:
+            // a deferred body was skipped, its scope never entered
+            if (flat_body(ast, node) != NODE_NONE && !is_deferred(checker)) exit_scope(checker->table);
+            break;
         case AST_LITERAL:
-        case AST_IDENTIFIER:
-            // These are already type-checked in get_expression_type
-            return 1;
-            
-        case AST_FUNCTION_CALL: {
-            const char* func_name = node->current.lexeme;
-            
-            // Special handling for factorial
-            if (strcmp(func_name, "factorial") == 0) {
-                //print_symbol_table(table);
-                // Factorial requires exactly one argument
-                if (!node->body || node->body->next) {
-                    semantic_error(SEM_ERROR_INVALID_OPERATION, "factorial requires exactly one argument", node->current.line);
-                    return 0;
-                }
-                
-                // Check argument type (must be int or uint)
-                DataType arg_type = get_expression_type(node->body, table);
-                if (arg_type != TYPE_INT && arg_type != TYPE_UINT) {
-                    semantic_error(SEM_ERROR_TYPE_MISMATCH, "factorial argument must be integer", node->current.line);
-                    return 0;
-                }
-                
-                // this doesnt make sense, can't make the node type a DataType
-                // it's supposed to be a ASTType
-                // it also doesn't work
-                // Factorial returns int
-                //node->type = TYPE_INT;
-                return 1;
+            ast->data_type[node] = literal_type(flat_ast_token(ast, node));
+            break;
+        case AST_IDENTIFIER: {
+            const Token name = flat_ast_token(ast, node);
+            int var_index;
+            Symbol* sym = resolve(checker, name, &var_index);
+            if (!sym) {
+                checker_error_token(checker, SEM_ERROR_UNDECLARED_VARIABLE, name, line);
+                fail(checker);
+                ast->data_type[node] = TYPE_ERROR;
+            } else {
+                // later phases go by var_index, no more lookups by name
+                ast->var_index[node] = var_index;
+                ast->data_type[node] = sym->type;
             }
-            
-            // Add other function validations here if needed
-            Symbol* symbol = lookup_symbol(table, func_name);
-            //print_symbol_table(table);
-            if (!symbol)
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "unknown function", node->current.line);
-            return 0;
+            break;
         }
-        
-        default:
-            return 0;
-    }
-}
-
-// Check statement
-int check_statement(ASTNode* node, SymbolTable* table) {
-    int result = 1;
-    switch (node->type) {
-        case AST_BLOCK:
-            result = check_block(node->body, table) && result;
+        case AST_BINOP:
+            ast->data_type[node] = check_binop(node, checker);
             break;
-        case AST_VARDECLTYPE:
-        case AST_VARDECLFUNC:
-        // case AST_VARDECL:
-            result = check_declaration(node, table) && result;
+        case AST_UNARYOP: {
+            const DataType operand = child_type(ast, flat_right(ast, node));
+            // Logical NOT - result is always boolean (int), the others keep the operand type
+            if (operand == TYPE_ERROR) ast->data_type[node] = TYPE_ERROR;
+            else ast->data_type[node] = flat_kind(ast, node) == OP_NOT ? TYPE_INT : operand;
+            break;
+        }
+        case AST_FUNCTION_CALL:
+            ast->data_type[node] = check_call(node, checker);
             break;
         case AST_ASSIGN:
-            result = check_assignment(node, table) && result;
+            ast->data_type[node] = check_assignment(node, checker);
             break;
         case AST_IF:
-            // Validate condition
-            result = check_condition(node->left, table) && result;
-            // Validate 'then' block
-            if (node->body) {
-                result = check_block(node->body, table) && result;
-            }
-            // Validate 'else' block if it exists
-            if (node->right) {
-                result = check_block(node->right, table) && result;
-            }
-            break;
         case AST_WHILE:
-            // Validate condition
-            result = check_condition(node->left, table) && result;
-            // Validate loop body
-            if (node->body) {
-                result = check_block(node->body, table) && result;
-            } else {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "while", node->current.line);
-                result = 0;
-            }
+            check_condition(flat_left(ast, node), checker, line);
             break;
         case AST_REPEAT:
-            // Validate body first (since it executes at least once)
-            if (node->body) {
-                result = check_block(node->body, table) && result;
-            } else {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "repeat", node->current.line);
-                result = 0;
-            }
-            // Validate condition
-            if (node->left) {
-                result = check_condition(node->left, table) && result;
-            } else {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "until", node->current.line);
-                result = 0;
-            }
+            // the block comes first, it executes at least once
+            check_condition(flat_right(ast, node), checker, line);
             break;
         case AST_PRINT:
             // Print statement must have an expression to print
-            if (!node->body) {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "print statement requires an expression", node->current.line);
-                return 0;
+            if (flat_right(ast, node) == NODE_NONE) {
+                checker_error(checker, SEM_ERROR_INVALID_OPERATION, "print statement requires an expression", line);
+                fail(checker);
             }
-            
-            // Check that the expression is valid
-            result = check_expression(node->body, table);
-            
             // All types are printable, so no need for type checking
-            return result;
-        case AST_FUNCTION_CALL:
-            // Validate function call as a statement
-            return check_expression(node, table);
+            break;
         default:
             break;
+    }
+    fold_leave(&checker->constants, ast, frame);
+}
 
+static const ASTVisitor checker_visitor = { check_enter, check_leave };
+
+/* Parallel checking
+ * Pass 1 checks the program on the calling thread with every top level
+ * function body deferred, which leaves all globals in the table. Workers then
+ * take bodies off the queue and check them against a table of their own for
+ * the args and locals, looking names up in the globals read only. Each
+ * worker writes to its own buffer and every body's part of it is spliced back
+ * in where pass 1 skipped the body, so the output is exactly that of a
+ * sequential run.
+ * A worker numbers variables in its own table from local_base. Once all
+ * bodies are done they are copied after the globals in source order and the
+ * var_index of each body's nodes, a contiguous range of the flat AST, are
+ * shifted to match, again in parallel.
+ * Only built with pthreads, sysconf and open_memstream (CHECK_THREADS).
+ */
+#ifdef CHECK_THREADS
+#define MAX_CHECK_THREADS 64
+
+typedef struct CheckWorker CheckWorker;
+
+typedef struct {
+    FlatAST* ast;
+    CheckTask* tasks;
+    int task_count;
+    atomic_int next;            // First task nobody has taken yet
+    SymbolTable* globals;
+    int local_base;             // Variables declared in pass 1
+    CheckWorker* workers;
+} CheckQueue;
+
+struct CheckWorker {
+    CheckQueue* queue;
+    int id;
+    SymbolTable* table;
+    FILE* out;
+    char* output;               // Written through out, complete once it is closed
+    size_t output_size;
+    int result;
+};
+
+static void* check_worker(void* arg) {
+    CheckWorker* worker = arg;
+    CheckQueue* queue = worker->queue;
+    for (;;) {
+        int i = atomic_fetch_add(&queue->next, 1);
+        if (i >= queue->task_count) break;
+        CheckTask* task = &queue->tasks[i];
+        Checker checker = {
+            .ast = queue->ast, .table = worker->table, .result = 1, .out = worker->out,
+            .globals = queue->globals, .visible = task->visible, .local_base = queue->local_base,
+        };
+        task->worker = worker->id;
+        task->output_start = (size_t)ftell(worker->out);
+        task->var_first = worker->table->variable_count;
+        if (ast_walk(queue->ast, task->function, &checker_visitor, &checker) < 0) {
+            fprintf(stderr, "No memory for the semantic checker\n");
+            checker.result = 0;
+        }
+        fold_free(&checker.constants);
+        task->output_end = (size_t)ftell(worker->out);
+        task->var_count = worker->table->variable_count - task->var_first;
+        worker->result = worker->result && checker.result;
+    }
+    return NULL;
+}
 
+static void* renumber_worker(void* arg) {
+    CheckWorker* worker = arg;
+    CheckQueue* queue = worker->queue;
+    for (;;) {
+        int i = atomic_fetch_add(&queue->next, 1);
+        if (i >= queue->task_count) break;
+        const CheckTask* task = &queue->tasks[i];
+        if (task->var_count == 0) continue;
+        const SymbolTable* from = queue->workers[task->worker].table;
+        memcpy(queue->globals->variables + task->var_base, from->variables + task->var_first,
+               sizeof(Variable) * task->var_count);
+        const int shift = task->var_base - queue->local_base - task->var_first;
+        int32_t* var_index = queue->ast->var_index;
+        const NodeId end = flat_ast_end(queue->ast, task->function);
+        for (NodeId node = task->function; node < end; node++) {
+            // globals and VAR_NONE are below local_base and stay as they are
+            if (var_index[node] >= queue->local_base) var_index[node] += shift;
+        }
     }
-    return result;
+    return NULL;
 }
 
-// Check a block of statements, handling scope
-int check_block(ASTNode* node, SymbolTable* table) {
-    enter_scope(table);
-    int result = 1;
-    
-    ASTNode* temp = node;
-    while (temp) {
-        result = check_statement(temp, table) && result;
-        temp = temp->next;
-    }
-    //print_symbol_table(table);
-    //remove_symbols_in_current_scope(table);
-    exit_scope(table);
-    return result;
+// Runs fn on every worker that could be started, the calling thread is worker 0.
+// Tasks are taken off the queue, a worker that didn't start leaves them to the others
+static void run_workers(CheckWorker* workers, int threads, void* (*fn)(void*)) {
+    pthread_t ids[MAX_CHECK_THREADS];
+    atomic_store(&workers[0].queue->next, 0);
+    int started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&ids[started], NULL, fn, &workers[started]) != 0) break;
+    }
+    fn(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
 }
 
-// Check a condition (e.g., in if statements)
-int check_condition(ASTNode* node, SymbolTable* table) {
-    if (!node) {
-        semantic_error(SEM_ERROR_INVALID_OPERATION, "condition", 0);
-        return 0;
+static void free_workers(CheckWorker* workers, int threads) {
+    for (int i = 0; i < threads; i++) {
+        if (workers[i].out) fclose(workers[i].out);
+        free(workers[i].output);
+        if (workers[i].table) free_symbol_table(workers[i].table);
     }
+}
 
-    switch (node->type) {
-        case AST_BINOP: {
-            // First check if it's a comparison operator
-            const char* op = node->current.lexeme;
-            int is_comparison = (strcmp(op, "<") == 0 || 
-                               strcmp(op, ">") == 0 || 
-                               strcmp(op, "<=") == 0 || 
-                               strcmp(op, ">=") == 0 || 
-                               strcmp(op, "==") == 0 || 
-                               strcmp(op, "!=") == 0 ||
-                               strcmp(op, "&&") == 0 || 
-                               strcmp(op, "||") == 0);
-
-            if (!is_comparison && strcmp(op, "!") != 0) {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "Invalid condition operator", node->current.line);
-                return 0;
-            }
+static int count_functions(const FlatAST* ast, NodeId program) {
+    int count = 0;
+    for (NodeId node = flat_body(ast, program); node != NODE_NONE; node = flat_next(ast, node)) {
+        const NodeId decl = flat_body(ast, node);
+        if (flat_type(ast, node) == AST_VARDECLTYPE && decl != NODE_NONE && flat_type(ast, decl) == AST_VARDECL &&
+            flat_body(ast, decl) != NODE_NONE) count++;
+    }
+    return count;
+}
 
-            // Validate both operands
-            if (!node->left || !node->right) {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, op, node->current.line);
-                return 0;
-            }
+static int check_threads(int functions) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = functions / PARALLEL_MIN_FUNCTIONS;
+    if (cpus > 0 && threads > cpus) threads = (int)cpus;
+    if (threads > MAX_CHECK_THREADS) threads = MAX_CHECK_THREADS;
+    return threads > 1 ? threads : 1;
+}
 
-            // Check types are compatible
-            DataType left_type = get_expression_type(node->left, table);
-            DataType right_type = get_expression_type(node->right, table);
-            
-            TypeCompatibility compat = check_type_compatibility(left_type, right_type);
-            if (compat == TYPE_COMPAT_ERROR) {
-                semantic_error(SEM_ERROR_TYPE_MISMATCH, op, node->current.line);
-                return 0;
-            }
+// Returns -1 if the workers couldn't be set up, nothing was checked then
+static int check_parallel(FlatAST* ast, NodeId program, SymbolTable* table, int threads) {
+    CheckWorker workers[MAX_CHECK_THREADS];
+    CheckQueue queue = { .ast = ast, .globals = table, .workers = workers };
+    char* global_output = NULL;
+    size_t global_size = 0;
+    memset(workers, 0, sizeof(CheckWorker) * threads);
+    FILE* global_out = open_memstream(&global_output, &global_size);
+    int ready = global_out != NULL;
+    for (int i = 0; i < threads && ready; i++) {
+        workers[i].queue = &queue;
+        workers[i].id = i;
+        workers[i].result = 1;
+        workers[i].table = init_symbol_table();
+        if (workers[i].table) workers[i].out = open_memstream(&workers[i].output, &workers[i].output_size);
+        ready = workers[i].out != NULL;
+    }
+    if (!ready) {
+        if (global_out) fclose(global_out);
+        free(global_output);
+        free_workers(workers, threads);
+        return -1;
+    }
 
-            return 1;
+    Checker checker = { .ast = ast, .table = table, .result = 1, .out = global_out, .defer = 1 };
+    if (ast_walk(ast, program, &checker_visitor, &checker) < 0) {
+        fprintf(stderr, "No memory for the semantic checker\n");
+        checker.result = 0;
+        checker.task_count = 0;
+    }
+    fold_free(&checker.constants);
+    fclose(global_out);
+    queue.tasks = checker.tasks;
+    queue.task_count = checker.task_count;
+    queue.local_base = table->variable_count;
+    run_workers(workers, threads, check_worker);
+    for (int i = 0; i < threads; i++) {
+        fclose(workers[i].out);
+        workers[i].out = NULL;
+    }
+
+    // lay the bodies' variables out after the globals, in source order
+    int count = queue.local_base;
+    for (int i = 0; i < queue.task_count; i++) {
+        queue.tasks[i].var_base = count;
+        count += queue.tasks[i].var_count;
+    }
+    int result = checker.result;
+    if (count > table->variable_capacity) {
+        Variable* grown = realloc(table->variables, sizeof(Variable) * count);
+        if (grown) {
+            table->variables = grown;
+            table->variable_capacity = count;
         }
+    }
+    if (count <= table->variable_capacity) {
+        run_workers(workers, threads, renumber_worker);
+        table->variable_count = count;
+    } else {
+        fprintf(stderr, "No memory for the symbol table\n");
+        result = 0;
+    }
 
-        case AST_UNARYOP: {
-            // Only allow logical NOT in conditions
-            if (strcmp(node->current.lexeme, "!") != 0) {
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "Invalid unary operator in condition", node->current.line);
-                return 0;
+    // splice each body's output back in where pass 1 skipped it
+    size_t written = 0;
+    for (int i = 0; i < queue.task_count; i++) {
+        const CheckTask* task = &queue.tasks[i];
+        const CheckWorker* worker = &workers[task->worker];
+        fwrite(global_output + written, 1, task->global_output - written, stdout);
+        fwrite(worker->output + task->output_start, 1, task->output_end - task->output_start, stdout);
+        written = task->global_output;
+    }
+    fwrite(global_output + written, 1, global_size - written, stdout);
+
+    for (int i = 0; i < threads; i++) {
+        result = result && workers[i].result;
+    }
+    free(global_output);
+    free(checker.tasks);
+    free_workers(workers, threads);
+    return result;
+}
+#endif
+
+// Check program node
+// Programs with enough top level functions check their bodies in parallel
+int check_program(FlatAST* ast, NodeId node, SymbolTable* table) {
+    if (node == NODE_NONE || node >= ast->count) return 1;
+#ifdef CHECK_THREADS
+    if (flat_type(ast, node) == AST_PROGRAM) {
+        int threads = check_threads(count_functions(ast, node));
+        int result = threads > 1 ? check_parallel(ast, node, table, threads) : -1;
+        if (result >= 0) return result;
+    }
+#endif
+    Checker checker = { .ast = ast, .table = table, .result = 1, .out = stdout };
+    int walked = ast_walk(ast, node, &checker_visitor, &checker);
+    fold_free(&checker.constants);
+    if (walked < 0) {
+        fprintf(stderr, "No memory for the semantic checker\n");
+        return 0;
+    }
+    return checker.result;
+}
+
+// Checks node and returns its type, TYPE_UNKNOWN for statements
+DataType get_expression_type(FlatAST* ast, NodeId node, SymbolTable* table) {
+    if (node == NODE_NONE) return TYPE_UNKNOWN;
+    check_program(ast, node, table);
+    return ast->data_type[node];
+}
+
+TypeCompatibility check_type_compatibility(DataType left, DataType right) {
+    if (left == right) return TYPE_COMPAT_OK;
+    
+    // Handle numeric type conversions - both integers and floats are compatible
+    if ((left == TYPE_INT || left == TYPE_UINT || left == TYPE_FLOAT) &&
+        (right == TYPE_INT || right == TYPE_UINT || right == TYPE_FLOAT)) {
+        return TYPE_COMPAT_OK;  // Changed from TYPE_COMPAT_CONVERT to TYPE_COMPAT_OK
+    }
+    
+    return TYPE_COMPAT_ERROR;
+}
+
+DataType get_result_type(DataType left, DataType right, TokenKind operator) {
+    switch (operator) {
+        // Handle arithmetic operators
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            // If either operand is float, result is float
+            if (left == TYPE_FLOAT || right == TYPE_FLOAT) {
+                return TYPE_FLOAT;
             }
-            return check_condition(node->right, table);
-        }
+            // If both are integers (signed or unsigned), result is int
+            return TYPE_INT;
 
-        case AST_IDENTIFIER:
-        case AST_LITERAL: {
-            // Allow boolean/numeric values in conditions
-            DataType type = get_expression_type(node, table);
-            if (type != TYPE_INT && type != TYPE_UINT && type != TYPE_FLOAT) {
-                semantic_error(SEM_ERROR_TYPE_MISMATCH, "Condition must be numeric or boolean", node->current.line);
-                return 0;
+        // Integer only operators
+        case OP_MOD:
+        case OP_SHL:
+        case OP_SHR:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_XOR:
+            if ((left == TYPE_INT || left == TYPE_UINT || left == TYPE_CHAR) &&
+                (right == TYPE_INT || right == TYPE_UINT || right == TYPE_CHAR)) {
+                return TYPE_INT;
             }
-            return 1;
-        }
+            return TYPE_UNKNOWN;
+
+        // Handle comparison and logical operators
+        case OP_LT:
+        case OP_GT:
+        case OP_LE:
+        case OP_GE:
+        case OP_EQ:
+        case OP_NE:
+        case OP_AND:
+        case OP_OR:
+            return TYPE_INT;  // Boolean result
 
         default:
-            semantic_error(SEM_ERROR_INVALID_OPERATION, "Invalid condition expression", node->current.line);
-            return 0;
+            return TYPE_UNKNOWN;
     }
 }
 
@@ -651,54 +982,63 @@ Step 4
 */
 
 // Report semantic errors
-void semantic_error(SemanticErrorType error, const char* name, int line) {
-    printf("Semantic Error at line %d: ", line);
+static void report_error(FILE* out, SemanticErrorType error, const char* name, int name_length, int line) {
+    fprintf(out, "Semantic Error at line %d: ", line);
     
     switch (error) {
         case SEM_ERROR_UNDECLARED_VARIABLE:
-            printf("Undeclared variable '%s'\n", name);
+            fprintf(out, "Undeclared variable '%.*s'\n", name_length, name);
             break;
         case SEM_ERROR_REDECLARED_VARIABLE:
-            printf("Variable '%s' already declared in this scope\n", name);
+            fprintf(out, "Variable '%.*s' already declared in this scope\n", name_length, name);
             break;
         case SEM_ERROR_TYPE_MISMATCH:
-            printf("Type mismatch involving '%s'\n", name);
+            fprintf(out, "Type mismatch involving '%.*s'\n", name_length, name);
             break;
         case SEM_ERROR_UNINITIALIZED_VARIABLE:
-            printf("Variable '%s' may be used uninitialized\n", name);
+            fprintf(out, "Variable '%.*s' may be used uninitialized\n", name_length, name);
             break;
         case SEM_ERROR_INVALID_OPERATION:
-            printf("Invalid operation involving '%s'\n", name);
+            fprintf(out, "Invalid operation involving '%.*s'\n", name_length, name);
             break;
         default:
-            printf("Unknown semantic error with '%s'\n", name);
+            fprintf(out, "Unknown semantic error with '%.*s'\n", name_length, name);
     }
 }
 
+void semantic_error(SemanticErrorType error, const char* name, int line) {
+    report_error(stdout, error, name, (int)strlen(name), line);
+}
+
+// Same as semantic_error, but names the lexeme of a token
+void semantic_error_token(SemanticErrorType error, const Token name, int line) {
+    report_error(stdout, error, name.start, name.length, line);
+}
+
 // Let's also add a helper function to validate function arguments:
-int validate_function_args(ASTNode* args, SymbolTable* table, const char* func_name) {
-    if (strcmp(func_name, "factorial") == 0) {
+int validate_function_args(FlatAST* ast, NodeId args, SymbolTable* table, const Token func_name) {
+    if (token_is(func_name, "factorial")) {
         // Count arguments
         int arg_count = 0;
-        ASTNode* current = args;
-        while (current) {
+        NodeId current = args;
+        while (current != NODE_NONE) {
             arg_count++;
-            current = current->next;
+            current = flat_next(ast, current);
         }
         
         if (arg_count != 1) {
             semantic_error(SEM_ERROR_INVALID_OPERATION, 
                          "factorial requires exactly one argument", 
-                         args ? args->current.line : 0);
+                         args != NODE_NONE ? flat_line(ast, args) : 0);
             return 0;
         }
         
         // Check argument type
-        DataType arg_type = get_expression_type(args, table);
+        DataType arg_type = get_expression_type(ast, args, table);
         if (arg_type != TYPE_INT && arg_type != TYPE_UINT) {
             semantic_error(SEM_ERROR_TYPE_MISMATCH, 
                          "factorial argument must be integer", 
-                         args->current.line);
+                         flat_line(ast, args));
             return 0;
         }
         
@@ -727,10 +1067,10 @@ void print_symbol_table(SymbolTable* table) {
     int index = 0;
     while (current) {
         printf("Symbol[%d]:\n", index++);
-        printf("  Name: %s\n", current->name);
+        printf("  Name: %s\n", intern_text(current->name));
         printf("  Type: %d\n", current->type);
         printf("  Scope Level: %d\n", current->scope_level);
-        printf("  Line Declared: %d\n", current->line_declared);
+        printf("  Line Declared: %d\n", table->variables[current->var_index].line_declared);
         printf("  Initialized: %s\n\n", current->is_initialized ? "Yes" : "No");
         current = current->next;
     }
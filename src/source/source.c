@@ -0,0 +1,117 @@
+#include "source.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define STREAM_CHUNK 65536
+
+int source_from_stream(SourceBuffer* src, FILE* fp) {
+    size_t capacity = STREAM_CHUNK;
+    size_t length = 0;
+    char* data = malloc(capacity);
+    if (!data) return -1;
+
+    size_t n;
+    while ((n = fread(data + length, 1, capacity - length, fp)) > 0) {
+        length += n;
+        if (length > SOURCE_MAX_LENGTH) {
+            fputs("Input is too large\n", stderr);
+            free(data);
+            return -1;
+        }
+        if (length == capacity) {
+            capacity *= 2;
+            char* grown = realloc(data, capacity);
+            if (!grown) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+        }
+    }
+    if (ferror(fp)) {
+        fputs("Error reading file\n", stderr);
+        free(data);
+        return -1;
+    }
+    if (length == 0) {
+        free(data);
+        data = "";
+    }
+
+    src->data = data;
+    src->length = length;
+    src->mapped = 0;
+    return 0;
+}
+
+int source_open(SourceBuffer* src, const char* path) {
+    memset(src, 0, sizeof(SourceBuffer));
+    if (strcmp(path, "-") == 0) {
+        return source_from_stream(src, stdin);
+    }
+
+#ifdef HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if ((unsigned long long)st.st_size > SOURCE_MAX_LENGTH) {
+            fprintf(stderr, "%s is too large\n", path);
+            close(fd);
+            return -1;
+        }
+        if (st.st_size == 0) {
+            // mmap refuses zero length mappings, an empty file is just empty
+            close(fd);
+            src->data = "";
+            return 0;
+        }
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            src->data = data;
+            src->length = (size_t)st.st_size;
+            src->mapped = 1;
+            return 0;
+        }
+    }
+
+    // Not mappable (fifo, char device, ...), fall back to streaming it in
+    FILE* fp = fdopen(fd, "r");
+    if (!fp) {
+        close(fd);
+        return -1;
+    }
+#else
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+#endif
+    int result = source_from_stream(src, fp);
+    fclose(fp);
+    return result;
+}
+
+void source_close(SourceBuffer* src) {
+    if (src->mapped) {
+#ifdef HAVE_MMAP
+        munmap((void*)src->data, src->length);
+#endif
+    } else if (src->length > 0) {
+        free((void*)src->data);
+    }
+    memset(src, 0, sizeof(SourceBuffer));
+}